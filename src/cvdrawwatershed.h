@@ -27,40 +27,54 @@
 #define CV_DRAWWATERSHED_INCLUDED
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
 #include <string>
 
 // marker's shape is like circle
 // just for imageclipper.cpp for now
+// watershed runs only around the circle, so the cost does not grow with the image size
 CvRect cvDrawWatershed( IplImage* img, const CvRect circle )
 {
-    IplImage* markers  = cvCreateImage( cvGetSize( img ), IPL_DEPTH_32S, 1 );
     CvPoint center = cvPoint( circle.x, circle.y );
     int radius = circle.width;
 
+    // the ambiguous region ends at 3 * radius. 2 more pixels for the gradient and the outer boundary
+    int reach = 3 * abs( radius ) + 2;
+    int x1 = std::max( center.x - reach, 0 ), y1 = std::max( center.y - reach, 0 );
+    int x2 = std::min( center.x + reach + 1, img->width ), y2 = std::min( center.y + reach + 1, img->height );
+    if( x2 - x1 < 3 || y2 - y1 < 3 )
+        return cvRect( img->width, img->height, -img->width, -img->height );
+    CvMat roi;
+    cvGetSubRect( img, &roi, cvRect( x1, y1, x2 - x1, y2 - y1 ) );
+    IplImage* markers  = cvCreateImage( cvSize( x2 - x1, y2 - y1 ), IPL_DEPTH_32S, 1 );
+    CvPoint local = cvPoint( center.x - x1, center.y - y1 );
+
     // Set watershed markers. Now, marker's shape is like circle
     // Set (1 * radius) - (3 * radius) region as ambiguous region (0), intuitively
     cvSet( markers, cvScalarAll( 1 ) );
-    cvCircle( markers, center, 3 * radius, cvScalarAll( 0 ), CV_FILLED, 8, 0 );
-    cvCircle( markers, center, radius, cvScalarAll( 2 ), CV_FILLED, 8, 0 );
-    cvWatershed( img, markers );
+    cvCircle( markers, local, 3 * radius, cvScalarAll( 0 ), CV_FILLED, 8, 0 );
+    cvCircle( markers, local, radius, cvScalarAll( 2 ), CV_FILLED, 8, 0 );
+    cvWatershed( &roi, markers );
 
     // Draw watershed markers and rectangle surrounding watershed markers
     cvCircle( img, center, radius, cvScalarAll (255), 2, 8, 0);
 
-    CvPoint minpoint = cvPoint( markers->width, markers->height );
+    CvPoint minpoint = cvPoint( img->width, img->height );
     CvPoint maxpoint = cvPoint( 0, 0 );
     for (int y = 1; y < markers->height-1; y++) { // looks outer boundary is always -1. 
         for (int x = 1; x < markers->width-1; x++) {
             int* idx = (int *) cvPtr2D (markers, y, x, NULL);
             if (*idx == -1) { // watershed marker -1
-                cvSet2D (img, y, x, cvScalarAll (255));
-                if( x < minpoint.x ) minpoint.x = x;
-                if( y < minpoint.y ) minpoint.y = y;
-                if( x > maxpoint.x ) maxpoint.x = x;
-                if( y > maxpoint.y ) maxpoint.y = y;
+                cvSet2D (&roi, y, x, cvScalarAll (255));
+                if( x1 + x < minpoint.x ) minpoint.x = x1 + x;
+                if( y1 + y < minpoint.y ) minpoint.y = y1 + y;
+                if( x1 + x > maxpoint.x ) maxpoint.x = x1 + x;
+                if( y1 + y > maxpoint.y ) maxpoint.y = y1 + y;
             }
         }
     }
+    cvReleaseImage( &markers );
     return cvRect( minpoint.x, minpoint.y, maxpoint.x - minpoint.x, maxpoint.y - minpoint.y );
 }
 
@@ -31,7 +31,15 @@
 #define FILESYSTEM_INCLUDED
 
 #include <boost/filesystem.hpp>
+#include <errno.h>
+#include <stdio.h>
 #include <vector>
+#ifdef WIN32
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 using namespace std;
 
 namespace fs {
@@ -42,6 +50,42 @@ namespace fs {
         boost::filesystem::create_directories( fspath );
     }
 
+    // replaces new_path atomically if it exists
+    inline void rename( const string& old_path, const string& new_path )
+    {
+        boost::filesystem::rename( boost::filesystem::path( old_path ), boost::filesystem::path( new_path ) );
+    }
+
+    // flushes a file being written through fp to the disk
+    inline bool sync( FILE* fp )
+    {
+#ifdef WIN32
+        return fflush( fp ) == 0 && _commit( _fileno( fp ) ) == 0;
+#else
+        return fflush( fp ) == 0 && fsync( fileno( fp ) ) == 0;
+#endif
+    }
+
+    // flushes the entries of a directory, e.g., a rename in it, to the disk
+    inline bool sync_directory( const string& path )
+    {
+#ifdef WIN32
+        return true; // NTFS journals the entries itself, and directories cannot be opened as files
+#else
+        int fd = open( path.empty() ? "." : path.c_str(), O_RDONLY );
+        if( fd < 0 ) return false;
+        bool ok = ( fsync( fd ) == 0 || errno == EINVAL ); // EINVAL: not supported by the file system
+        close( fd );
+        return ok;
+#endif
+    }
+
+    inline void remove( const string& path )
+    {
+        boost::system::error_code ec;
+        boost::filesystem::remove( boost::filesystem::path( path ), ec );
+    }
+
     inline bool is_directory( const string& path )
     {
         boost::filesystem::path fspath( path );
@@ -54,12 +98,32 @@ namespace fs {
         return boost::filesystem::exists( fspath );
     }
 
+    inline uintmax_t file_size( const string& path )
+    {
+        boost::filesystem::path fspath( path );
+        return boost::filesystem::file_size( fspath );
+    }
+
+    inline time_t last_write_time( const string& path )
+    {
+        boost::filesystem::path fspath( path );
+        return boost::filesystem::last_write_time( fspath );
+    }
+
     inline string realpath( const string& path )
     {
         boost::filesystem::path fspath( path );
         return fspath.string();
     }
 
+    // absolute path with symbolic links resolved. path itself on errors
+    inline string canonical( const string& path )
+    {
+        boost::system::error_code ec;
+        boost::filesystem::path fspath = boost::filesystem::canonical( boost::filesystem::path( path ), ec );
+        return ec ? path : fspath.string();
+    }
+
     inline string dirname( const string& path )
     {
         boost::filesystem::path fspath( path );
@@ -99,8 +163,8 @@ namespace fs {
     {
         std::string extension = boost::filesystem::extension( filename );
         extension = fs::strtolower( extension );
-        for( std::size_t i = 0; i < extensions.size() - 1; i++ ) {
-            if( extension == "." + extensions[i] ) return true;
+        for( std::size_t i = 0; i < extensions.size(); i++ ) {
+            if( extension.size() == extensions[i].size() + 1 && extension.compare( 1, string::npos, extensions[i] ) == 0 ) return true;
         }
         return false;
     }
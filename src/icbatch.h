@@ -0,0 +1,596 @@
+/** @file
+*
+* Image clipper headless batch cropping driven by an annotation manifest
+*
+* The MIT License
+*
+* Copyright (c) 2008, Naotoshi Seo <sonots(at)umd.edu>
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+#ifndef IC_BATCH_INCLUDED
+#define IC_BATCH_INCLUDED
+
+#include "cv.h"
+#include "cxcore.h"
+#include "highgui.h"
+#include <limits.h>
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "filesystem.h"
+#include "icformat.h"
+#include "icjpeg.h"
+#include "icmmap.h"
+#include "icpng.h"
+#include "icprobe.h"
+#include "icsavequeue.h"
+#include "icsurface.h"
+#include "icvideoindex.h"
+#include "opencvx/cvrect32f.h"
+#include "opencvx/cvcropimageroi.h"
+using namespace std;
+
+/**
+* One crop of an annotation manifest
+*/
+typedef struct IcCropSpec {
+    string path;               /**< source image or video */
+    int frame;                 /**< frame number (for video file) */
+    CvRect rect;               /**< rectangle region in source coordinates */
+    int rotate;                /**< rotation angle */
+    CvPoint shear;             /**< shear deformation */
+} IcCropSpec;
+
+/**
+* Crops sharing one source. The source is decoded once for all of them.
+*/
+typedef struct IcCropGroup {
+    string path;               /**< source image or video */
+    bool is_video;             /**< read frame by frame */
+    vector<IcCropSpec> specs;  /**< crops sorted by frame */
+} IcCropGroup;
+
+/**
+* Read an annotation manifest
+*
+* One crop per line, separated by white spaces:
+*   path frame x y width height [rotate [shear_x [shear_y]]]
+* Empty lines and lines starting with # are ignored.
+*
+* @param manifest The manifest filename
+* @param specs    The crops read
+* @return false if the manifest is not readable
+*/
+bool icReadManifest( const string& manifest, vector<IcCropSpec>& specs )
+{
+    ifstream ifs( manifest.c_str() );
+    if( !ifs ) return false;
+    string line;
+    int lineno = 0;
+    while( getline( ifs, line ) )
+    {
+        lineno++;
+        string::size_type start = line.find_first_not_of( " \t\r" );
+        if( start == string::npos || line[start] == '#' ) continue;
+        istringstream iss( line );
+        IcCropSpec spec = { "", 0, cvRect(0,0,0,0), 0, cvPoint(0,0) };
+        if( !( iss >> spec.path >> spec.frame
+                   >> spec.rect.x >> spec.rect.y >> spec.rect.width >> spec.rect.height ) ||
+            spec.rect.width <= 0 || spec.rect.height <= 0 )
+        {
+            cerr << manifest << ":" << lineno << ": malformed crop, skipped." << endl;
+            continue;
+        }
+        iss >> spec.rotate >> spec.shear.x >> spec.shear.y;
+        specs.push_back( spec );
+    }
+    return true;
+}
+
+inline bool icCropSpecLess( const IcCropSpec& a, const IcCropSpec& b )
+{
+    if( a.path != b.path ) return a.path < b.path;
+    return a.frame < b.frame;
+}
+
+/**
+* Group crops by source so that each image or frame is decoded once
+*
+* @param specs   The crops. Sorted in place by source and frame.
+* @param imtypes Image file types. Other files are read as videos.
+* @return vector<IcCropGroup>
+*/
+vector<IcCropGroup> icGroupCrops( vector<IcCropSpec>& specs, const vector<string>& imtypes )
+{
+    vector<IcCropGroup> groups;
+    stable_sort( specs.begin(), specs.end(), icCropSpecLess );
+    for( size_t i = 0; i < specs.size(); i++ )
+    {
+        if( groups.empty() || groups.back().path != specs[i].path )
+        {
+            IcCropGroup group;
+            group.path = specs[i].path;
+            group.is_video = !fs::match_extensions( specs[i].path, imtypes );
+            groups.push_back( group );
+        }
+        groups.back().specs.push_back( specs[i] );
+    }
+    return groups;
+}
+
+/**
+* Report crops reaching out of the image
+*
+* They are still written with the outside filled black.
+*
+* @param group The crop group of an image source
+* @param info  The image properties read from its file header
+* @return The number of crops out of the image bounds
+*/
+long icBatchCheckBounds( const IcCropGroup& group, const IcImageInfo& info )
+{
+    long out_of_bounds = 0;
+    for( size_t i = 0; i < group.specs.size(); i++ )
+    {
+        const IcCropSpec& spec = group.specs[i];
+        CvRect bound = icRectangleBoundingRect( cvRect32fFromRect( spec.rect, spec.rotate ),
+                                                cvPointTo32f( spec.shear ), 0 );
+        if( bound.x < 0 || bound.y < 0 ||
+            bound.x + bound.width - 1 > info.width || bound.y + bound.height - 1 > info.height )
+        {
+            cerr << fs::realpath( group.path ) << ": the crop " << spec.rect.x << " " << spec.rect.y << " "
+                 << spec.rect.width << " " << spec.rect.height << " reaches out of the image "
+                 << info.width << "x" << info.height << "." << endl;
+            out_of_bounds++;
+        }
+    }
+    return out_of_bounds;
+}
+
+/**
+* Check crops against the image sizes read from file headers without decoding
+*
+* Video frames and image types the probe does not know are not checked.
+*
+* @param groups        The crop groups
+* @param out_of_bounds The number of crops out of the image bounds
+* @return The number of crops whose source does not exist
+*/
+long icBatchValidate( const vector<IcCropGroup>& groups, long* out_of_bounds )
+{
+    long missing = 0;
+    *out_of_bounds = 0;
+    for( size_t g = 0; g < groups.size(); g++ )
+    {
+        const IcCropGroup& group = groups[g];
+        if( !fs::exists( group.path ) )
+        {
+            cerr << "The file " << fs::realpath( group.path ) << " does not exist. "
+                 << group.specs.size() << " crops skipped." << endl;
+            missing += (long)group.specs.size();
+            continue;
+        }
+        IcImageInfo info;
+        if( !group.is_video && icProbeImage( group.path, &info ) )
+            *out_of_bounds += icBatchCheckBounds( group, info );
+    }
+    return missing;
+}
+
+/**
+* Shared state of icBatchCrop workers
+*/
+typedef struct IcBatchState {
+    const vector<IcCropGroup>* groups;
+    const vector<string>* imtypes;
+    const char* imgout_format;
+    const char* vidout_format;
+    int interpolation;         /**< sampling of rotated and sheared crops */
+    atomic<size_t> next;       /**< next group to be taken */
+    atomic<long> written;      /**< number of crops written */
+    atomic<long> failed;       /**< number of crops failed */
+    mutex io_mutex;            /**< serializes console and directory creation */
+} IcBatchState;
+
+inline string icBatchFormatPath( const IcBatchState* state, const IcCropSpec& spec, bool is_video )
+{
+    return icFormat(
+        is_video ? state->vidout_format : state->imgout_format,
+        fs::dirname( spec.path ), fs::filename( spec.path ), fs::extension( spec.path ),
+        spec.rect.x, spec.rect.y, spec.rect.width, spec.rect.height,
+        spec.frame, spec.rotate, spec.shear.x, spec.shear.y );
+}
+
+/**
+* Make the output filename of a crop and its directory
+*
+* @return The output filename. Empty if its image type is not supported.
+*/
+string icBatchOutputPath( IcBatchState* state, const IcCropSpec& spec, bool is_video )
+{
+    string output_path = icBatchFormatPath( state, spec, is_video );
+    lock_guard<mutex> lock( state->io_mutex );
+    if( !fs::match_extensions( output_path, *state->imtypes ) )
+    {
+        cerr << "The image type " << fs::extension( output_path ) << " is not supported." << endl;
+        state->failed++;
+        return "";
+    }
+    fs::create_directories( fs::dirname( output_path ) );
+    return output_path;
+}
+
+void icBatchReport( IcBatchState* state, const string& output_path, bool saved )
+{
+    lock_guard<mutex> lock( state->io_mutex );
+    if( saved )
+    {
+        cout << fs::realpath( output_path ) << endl;
+        state->written++;
+    }
+    else
+    {
+        cerr << "Failed to write " << fs::realpath( output_path ) << endl;
+        state->failed++;
+    }
+}
+
+/**
+* Crop, encode and write one crop of an already decoded or a mapped source
+*
+* img may be a region of the source whose top-left is at origin.
+*/
+void icBatchWriteCrop( IcBatchState* state, const IplImage* img, const IcCropSpec& spec, bool is_video,
+                       const IcMappedImage* mapped = NULL, CvPoint origin = cvPoint( 0, 0 ) )
+{
+    string output_path = icBatchOutputPath( state, spec, is_video );
+    if( output_path.empty() ) return;
+
+    IplImage* crop;
+    if( mapped != NULL )
+    {
+        crop = icMappedCrop( mapped, cvRect32fFromRect( spec.rect, spec.rotate ), cvPointTo32f( spec.shear ),
+                             state->interpolation );
+    }
+    else
+    {
+        CvRect32f rect32f = cvRect32fFromRect( spec.rect, spec.rotate );
+        rect32f.x -= origin.x;
+        rect32f.y -= origin.y;
+        crop = cvCreateImage( cvSize( spec.rect.width, spec.rect.height ), img->depth, img->nChannels );
+        cvCropImageROI( img, crop, rect32f, cvPointTo32f( spec.shear ), state->interpolation );
+    }
+    bool saved = icSaveImageAtomic( fs::realpath( output_path ), crop );
+    cvReleaseImage( &crop );
+    icBatchReport( state, output_path, saved );
+}
+
+/**
+* The output filename of a crop to be written losslessly
+*
+* @return Empty if the crop is rotated, sheared or not written as JPEG
+*/
+string icBatchLosslessPath( const IcBatchState* state, const IcCropSpec& spec )
+{
+    static const char* jpeg_types[] = { "jpg", "jpeg", "jpe" };
+    static const vector<string> jpeg_imtypes( jpeg_types, jpeg_types + 3 );
+    if( spec.rotate != 0 || spec.shear.x != 0 || spec.shear.y != 0 ) return "";
+    string output_path = icBatchFormatPath( state, spec, false );
+    return fs::match_extensions( output_path, jpeg_imtypes ) ? output_path : "";
+}
+
+/**
+* Write an axis-aligned crop of a JPEG source to a JPEG file without decoding
+*
+* The DCT coefficients are copied as they are. See icJpegCropLossless.
+*
+* @param state       The batch state
+* @param spec        The crop
+* @param output_path The output filename. See icBatchLosslessPath.
+* @param coef        The coefficients of the source, shared by its crops
+* @return false if the crop is not losslessly croppable, i.e., not on iMCU
+*         boundaries or out of the image. Nothing is written then.
+*/
+bool icBatchWriteLossless( IcBatchState* state, const IcCropSpec& spec, const string& output_path,
+                           IcJpegCoefficients* coef )
+{
+    if( !icJpegLosslessCroppable( coef, spec.rect ) ) return false;
+    {
+        lock_guard<mutex> lock( state->io_mutex );
+        fs::create_directories( fs::dirname( output_path ) );
+    }
+
+    string tmp_path = fs::realpath( output_path ) + ".tmp";
+    FILE* fp = fopen( tmp_path.c_str(), "wb" );
+    if( fp == NULL ) return false;
+    bool ok = icJpegCropLossless( coef, spec.rect, fp ) && fs::sync( fp );
+    ok = ( fclose( fp ) == 0 ) && ok;
+    try
+    {
+        if( ok ) fs::rename( tmp_path, fs::realpath( output_path ) );
+        if( ok ) ok = fs::sync_directory( fs::dirname( fs::realpath( output_path ) ) );
+    }
+    catch( ... )
+    {
+        ok = false;
+    }
+    if( !ok )
+    {
+        fs::remove( tmp_path );
+        return false;
+    }
+    icBatchReport( state, output_path, true );
+    return true;
+}
+
+/**
+* Decode a region of a JPEG or PNG source
+*
+* @return 3 channels BGR IplImage* of the region, 16U for 16 bits PNG and 8U
+*         otherwise. NULL if not decodable this way.
+*/
+IplImage* icBatchLoadRegion( const string& path, int format, CvRect rect )
+{
+    if( format == IC_PROBE_JPEG ) return icLoadJpegRegion( path, rect );
+    if( format == IC_PROBE_PNG ) return icLoadPngRegion( path, rect );
+    return NULL;
+}
+
+/**
+* Decode only the rows under the crops of a JPEG or PNG source and write them
+*
+* One region bounds all of the crops. JPEG crops are decoded one by one
+* instead when their rows add up to fewer than the rows of the one region,
+* since JPEG skips the rows above a region cheaply while PNG inflates them.
+*
+* @return false if the source is not decodable this way, or all of its rows
+*         are needed anyway. Nothing is written then.
+*/
+bool icBatchProcessRegions( IcBatchState* state, const IcCropGroup& group, const IcImageInfo& info )
+{
+    string path = fs::realpath( group.path );
+    if( info.format != IC_PROBE_JPEG && info.format != IC_PROBE_PNG ) return false;
+    vector<CvRect> bounds;
+    int top = INT_MAX, bottom = INT_MIN, left = INT_MAX, right = INT_MIN, rows = 0;
+    for( size_t i = 0; i < group.specs.size(); i++ )
+    {
+        const IcCropSpec& spec = group.specs[i];
+        CvRect bound = icCropSourceRect( cvRect32fFromRect( spec.rect, spec.rotate ), cvPointTo32f( spec.shear ),
+                                         state->interpolation, cvSize( info.width, info.height ) );
+        if( bound.width == 0 || bound.height == 0 ) return false; // outside of the image
+        bounds.push_back( bound );
+        left = min( left, bound.x );
+        top = min( top, bound.y );
+        right = max( right, bound.x + bound.width );
+        bottom = max( bottom, bound.y + bound.height );
+        rows += bound.height;
+    }
+    if( top == 0 && bottom == info.height ) return false;
+
+    if( info.format == IC_PROBE_JPEG && rows < bottom - top )
+    {
+        for( size_t i = 0; i < group.specs.size(); i++ )
+        {
+            IplImage* region = icBatchLoadRegion( path, info.format, bounds[i] );
+            if( region == NULL && i == 0 ) return false; // e.g., CMYK. Let cvLoadImage try.
+            if( region == NULL )
+            {
+                lock_guard<mutex> lock( state->io_mutex );
+                cerr << "The image file " << path << " is not loadable." << endl;
+                state->failed++;
+                continue;
+            }
+            icBatchWriteCrop( state, region, group.specs[i], false, NULL, cvPoint( bounds[i].x, bounds[i].y ) );
+            cvReleaseImage( &region );
+        }
+        return true;
+    }
+    IplImage* region = icBatchLoadRegion( path, info.format, cvRect( left, top, right - left, bottom - top ) );
+    if( region == NULL ) return false;
+    for( size_t i = 0; i < group.specs.size(); i++ )
+        icBatchWriteCrop( state, region, group.specs[i], false, NULL, cvPoint( left, top ) );
+    cvReleaseImage( &region );
+    return true;
+}
+
+/**
+* Report a source that does not exist
+*
+* @return false if the source exists
+*/
+bool icBatchMissing( IcBatchState* state, const IcCropGroup& group )
+{
+    if( fs::exists( group.path ) ) return false;
+    lock_guard<mutex> lock( state->io_mutex );
+    cerr << "The file " << fs::realpath( group.path ) << " does not exist. "
+         << group.specs.size() << " crops skipped." << endl;
+    state->failed += (long)group.specs.size();
+    return true;
+}
+
+/**
+* Decode one source and write all of its crops
+*
+* Image sources are probed once here, in the worker, and their header is
+* shared by the checks and the decoders below.
+*/
+void icBatchProcessGroup( IcBatchState* state, const IcCropGroup& group )
+{
+    if( !group.is_video )
+    {
+        IcImageInfo info;
+        bool probed = icProbeImage( fs::realpath( group.path ), &info );
+        if( !probed && icBatchMissing( state, group ) ) return;
+        if( probed )
+        {
+            lock_guard<mutex> lock( state->io_mutex );
+            icBatchCheckBounds( group, info );
+        }
+        // uncompressed sources are cropped in place, touching only the pages under the crops
+        IcMappedImage* mapped = probed && ( info.format == IC_PROBE_BMP || info.format == IC_PROBE_PNM ) ?
+            icMapImage( fs::realpath( group.path ) ) : NULL;
+        if( mapped != NULL )
+        {
+            for( size_t i = 0; i < group.specs.size(); i++ )
+                icBatchWriteCrop( state, NULL, group.specs[i], false, mapped );
+            icReleaseMappedImage( &mapped );
+            return;
+        }
+        // axis-aligned JPEG to JPEG crops need neither decoding nor encoding
+        bool is_jpeg = probed && info.format == IC_PROBE_JPEG;
+        IcJpegCoefficients* coef = NULL;
+        bool opened = false;
+        IcCropGroup rest = group;
+        rest.specs.clear();
+        for( size_t i = 0; i < group.specs.size(); i++ )
+        {
+            string lossless_path = is_jpeg ? icBatchLosslessPath( state, group.specs[i] ) : "";
+            if( !lossless_path.empty() && !opened )
+            {
+                // the coefficients are read on the first crop, once for all of the crops
+                coef = icOpenJpegCoefficients( fs::realpath( group.path ) );
+                opened = true;
+            }
+            if( lossless_path.empty() || coef == NULL ||
+                !icBatchWriteLossless( state, group.specs[i], lossless_path, coef ) )
+                rest.specs.push_back( group.specs[i] );
+        }
+        icReleaseJpegCoefficients( &coef );
+        if( rest.specs.empty() || ( probed && icBatchProcessRegions( state, rest, info ) ) ) return;
+        // in BGR keeping 16 bits and float, see icSaveImageAtomic for the output
+        IplImage* img = cvLoadImage( fs::realpath( group.path ).c_str(),
+                                     CV_LOAD_IMAGE_ANYDEPTH | CV_LOAD_IMAGE_COLOR );
+        if( img == NULL )
+        {
+            lock_guard<mutex> lock( state->io_mutex );
+            cerr << "The image file " << fs::realpath( group.path ) << " is not loadable." << endl;
+            state->failed += (long)rest.specs.size();
+            return;
+        }
+        for( size_t i = 0; i < rest.specs.size(); i++ )
+            icBatchWriteCrop( state, img, rest.specs[i], false );
+        cvReleaseImage( &img );
+        return;
+    }
+
+    if( icBatchMissing( state, group ) ) return;
+    // frames are sorted, so decode forward and seek only over keyframes
+    CvCapture* cap = cvCaptureFromFile( fs::realpath( group.path ).c_str() );
+    size_t i = 0;
+    if( cap != NULL )
+    {
+        IcVideoIndex* index = icCreateVideoIndex( fs::realpath( group.path ) );
+        int pos = 0;
+        while( i < group.specs.size() )
+        {
+            int frame = max( 1, group.specs[i].frame );
+            IplImage* img = icVideoSeek( cap, index, &pos, frame - 1 );
+            if( img == NULL ) break;
+            for( ; i < group.specs.size() && max( 1, group.specs[i].frame ) == frame; i++ )
+                icBatchWriteCrop( state, img, group.specs[i], true );
+        }
+        icReleaseVideoIndex( &index );
+        cvReleaseCapture( &cap );
+    }
+    if( i < group.specs.size() )
+    {
+        lock_guard<mutex> lock( state->io_mutex );
+        cerr << "The file " << fs::realpath( group.path ) << " was assumed as a video, but frame "
+             << group.specs[i].frame << " is not loadable." << endl;
+        state->failed += (long)( group.specs.size() - i );
+    }
+}
+
+void icBatchWorker( IcBatchState* state )
+{
+    size_t g;
+    while( ( g = state->next++ ) < state->groups->size() )
+    {
+        icBatchProcessGroup( state, (*state->groups)[g] );
+    }
+}
+
+/**
+* Write every crop of a manifest without GUI
+*
+* @param manifest      The manifest filename. See icReadManifest.
+* @param imtypes       Image file types
+* @param imgout_format The output filename format for image sources. See icFormat.
+* @param vidout_format The output filename format for video sources. See icFormat.
+* @param [nthreads = 0] The number of worker threads. 0 uses all cores.
+* @param [dry_run = false] Only validate the manifest. See icBatchValidate.
+* @param [interpolation = CV_INTER_NN] The sampling of rotated and sheared crops
+* @return The number of crops failed, or of problems found for dry_run.
+*         -1 if the manifest is not readable.
+*/
+long icBatchCrop( const string& manifest, const vector<string>& imtypes,
+                  const char* imgout_format, const char* vidout_format, int nthreads = 0,
+                  bool dry_run = false, int interpolation = CV_INTER_NN )
+{
+    vector<IcCropSpec> specs;
+    if( !icReadManifest( manifest, specs ) )
+    {
+        cerr << "The manifest " << fs::realpath( manifest ) << " is not readable." << endl;
+        return -1;
+    }
+    vector<IcCropGroup> groups = icGroupCrops( specs, imtypes );
+    if( dry_run )
+    {
+        long out_of_bounds;
+        long missing = icBatchValidate( groups, &out_of_bounds );
+        cerr << "Checked " << specs.size() << " regions: " << missing << " not readable, "
+             << out_of_bounds << " out of bounds." << endl;
+        return missing + out_of_bounds;
+    }
+
+    if( nthreads <= 0 ) nthreads = max( 1, (int)thread::hardware_concurrency() );
+    nthreads = min( nthreads, max( 1, (int)groups.size() ) );
+    cerr << "Now cropping " << specs.size() << " regions from " << groups.size()
+         << " sources with " << nthreads << " threads..... " << endl;
+
+    IcBatchState state;
+    state.groups = &groups;
+    state.imtypes = &imtypes;
+    state.imgout_format = imgout_format;
+    state.vidout_format = vidout_format;
+    state.interpolation = interpolation;
+    state.next = 0;
+    state.written = 0;
+    state.failed = 0;
+
+    vector<thread> workers;
+    for( int i = 1; i < nthreads; i++ )
+        workers.push_back( thread( icBatchWorker, &state ) );
+    icBatchWorker( &state );
+    for( size_t i = 0; i < workers.size(); i++ )
+        workers[i].join();
+
+    cerr << "Done! " << state.written << " written, " << state.failed << " failed." << endl;
+    return state.failed;
+}
+
+#endif
@@ -0,0 +1,349 @@
+/** @file
+*
+* Image clipper directory catalog
+*
+* The sorted image files of a directory with their sizes and modification
+* times, cached on disk per directory so that reopening a directory costs
+* one file read instead of a directory scan. The catalog is
+* valid while the modification time of the directory does not change.
+* Catalogs are kept under $XDG_CACHE_HOME/imageclipper (~/.cache/imageclipper)
+* rather than in the image directory, whose modification time they would
+* change otherwise.
+*
+* The MIT License
+*
+* Copyright (c) 2008, Naotoshi Seo <sonots(at)umd.edu>
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+#ifndef IC_CATALOG_INCLUDED
+#define IC_CATALOG_INCLUDED
+
+#include "cxcore.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "filesystem.h"
+using namespace std;
+
+#define IC_CATALOG_MAGIC "imageclipper-catalog 2"
+
+/**
+* Components of a filename, split once per file
+*/
+typedef struct IcPathParts {
+    string dirname;            /**< directory */
+    string filename;           /**< filename without extension */
+    string extension;          /**< extension without dot */
+} IcPathParts;
+
+inline IcPathParts icSplitPath( const string& path )
+{
+    IcPathParts parts;
+    parts.dirname = fs::dirname( path );
+    parts.filename = fs::filename( path );
+    parts.extension = fs::extension( path );
+    return parts;
+}
+
+/**
+* A cataloged file
+*/
+typedef struct IcCatalogEntry {
+    string stem;               /**< filename without extension */
+    int ext;                   /**< index of IcCatalog::extensions. -1 if none */
+    uintmax_t size;            /**< file size */
+    time_t mtime;              /**< file modification time */
+} IcCatalogEntry;
+
+/**
+* Directory catalog
+*/
+typedef struct IcCatalog {
+    string dirpath;                    /**< directory as given */
+    string dirname;                    /**< fs::dirname of the cataloged paths */
+    string key;                        /**< absolute directory identifying the catalog */
+    time_t mtime;                      /**< directory modification time when cataloged */
+    vector<string> extensions;         /**< interned extensions */
+    vector<IcCatalogEntry> entries;    /**< sorted by filename */
+    bool dirty;                        /**< changed since read or written */
+} IcCatalog;
+
+inline string icCatalogEntryName( const IcCatalog* catalog, const IcCatalogEntry& entry )
+{
+    return entry.ext < 0 ? entry.stem : entry.stem + "." + catalog->extensions[entry.ext];
+}
+
+inline string icCatalogEntryPath( const IcCatalog* catalog, const IcCatalogEntry& entry )
+{
+    string name = icCatalogEntryName( catalog, entry );
+    return catalog->dirpath.empty() ? name : ( boost::filesystem::path( catalog->dirpath ) / name ).string();
+}
+
+/**
+* The filename part of a path without building a boost path
+*/
+inline string icPathName( const string& path )
+{
+    string::size_type slash = path.find_last_of( "/\\" );
+    return slash == string::npos ? path : path.substr( slash + 1 );
+}
+
+/**
+* The catalog filename of a directory. Empty if no cache directory is known.
+*/
+string icCatalogPath( const string& key )
+{
+    string cache;
+    if( getenv( "XDG_CACHE_HOME" ) ) cache = getenv( "XDG_CACHE_HOME" );
+    else if( getenv( "HOME" ) ) cache = string( getenv( "HOME" ) ) + "/.cache";
+    else if( getenv( "LOCALAPPDATA" ) ) cache = getenv( "LOCALAPPDATA" );
+    if( cache.empty() ) return "";
+    char hash[32];
+    sprintf( hash, "%016llx", (unsigned long long)std::hash<string>()( key ) );
+    return cache + "/imageclipper/" + hash + ".catalog";
+}
+
+IcCatalog* icCreateCatalog( const string& dirpath )
+{
+    IcCatalog* catalog = new IcCatalog();
+    catalog->dirpath = dirpath;
+    catalog->dirname = dirpath.empty() ? "" : fs::dirname( ( boost::filesystem::path( dirpath ) / "x" ).string() );
+    catalog->key = fs::canonical( dirpath.empty() ? "." : dirpath );
+    catalog->mtime = 0;
+    catalog->dirty = false;
+    return catalog;
+}
+
+void icReleaseCatalog( IcCatalog** catalog )
+{
+    delete *catalog;
+    *catalog = NULL;
+}
+
+/**
+* Read the catalog of a directory
+*
+* Do not forget icReleaseCatalog( &ret );
+*
+* @param dirpath The directory
+* @return IcCatalog*. NULL if the directory has never been cataloged.
+*         Test with icCatalogValid before trusting its entries.
+*/
+IcCatalog* icReadCatalog( const string& dirpath )
+{
+    IcCatalog* catalog = icCreateCatalog( dirpath );
+    string path = icCatalogPath( catalog->key );
+    ifstream ifs( path.c_str() );
+    string magic, key, line;
+    size_t nextensions, nentries;
+    bool ok = !path.empty() && ifs && getline( ifs, magic ) && magic == IC_CATALOG_MAGIC &&
+        ( ifs >> key ) && ifs.get() && getline( ifs, line ) && line == catalog->key &&
+        ( ifs >> key >> catalog->mtime >> key >> nextensions );
+    for( size_t i = 0; ok && i < nextensions; i++ )
+    {
+        ok = !!( ifs >> line );
+        catalog->extensions.push_back( line );
+    }
+    ok = ok && ( ifs >> key >> nentries ) && ifs.get();
+    if( ok ) catalog->entries.reserve( nentries );
+    for( size_t i = 0; ok && i < nentries; i++ )
+    {
+        // size mtime ext stem, the stem may contain spaces
+        IcCatalogEntry entry;
+        ok = !!getline( ifs, line );
+        istringstream iss( line );
+        ok = ok && ( iss >> entry.size >> entry.mtime >> entry.ext ) &&
+            iss.get() == ' ' && -1 <= entry.ext && entry.ext < (int)catalog->extensions.size();
+        if( ok ) getline( iss, entry.stem );
+        catalog->entries.push_back( entry );
+    }
+    if( !ok ) icReleaseCatalog( &catalog );
+    return catalog;
+}
+
+/**
+* Whether no file was added, removed or renamed since the directory was cataloged
+*/
+inline bool icCatalogValid( const IcCatalog* catalog )
+{
+    boost::system::error_code ec;
+    time_t mtime = boost::filesystem::last_write_time(
+        boost::filesystem::path( catalog->dirpath.empty() ? "." : catalog->dirpath ), ec );
+    return !ec && mtime == catalog->mtime;
+}
+
+bool icWriteCatalog( IcCatalog* catalog )
+{
+    string path = icCatalogPath( catalog->key );
+    if( path.empty() ) return false;
+    try
+    {
+        fs::create_directories( fs::dirname( path ) );
+        {
+            ofstream ofs( ( path + ".tmp" ).c_str() );
+            if( !ofs ) return false;
+            ofs << IC_CATALOG_MAGIC << endl;
+            ofs << "dir " << catalog->key << endl;
+            ofs << "mtime " << catalog->mtime << endl;
+            ofs << "extensions " << catalog->extensions.size() << endl;
+            for( size_t i = 0; i < catalog->extensions.size(); i++ )
+                ofs << catalog->extensions[i] << endl;
+            ofs << "entries " << catalog->entries.size() << endl;
+            for( size_t i = 0; i < catalog->entries.size(); i++ )
+            {
+                const IcCatalogEntry& entry = catalog->entries[i];
+                ofs << entry.size << " " << entry.mtime << " " << entry.ext << " " << entry.stem << endl;
+            }
+            if( !ofs ) return false;
+        }
+        fs::rename( path + ".tmp", path );
+    }
+    catch( ... )
+    {
+        fs::remove( path + ".tmp" );
+        return false;
+    }
+    catalog->dirty = false;
+    return true;
+}
+
+/**
+* Catalog the files found in a directory
+*
+* Files already in the previous catalog keep their entries as they are, so
+* that only new files are stat'ed.
+*
+* The directory modification time has a resolution of a second. A file added
+* later in the second the files began to be listed would not change it, so
+* such a recent time is not recorded and the catalog is validated again by a
+* scan on the next time.
+*
+* @param previous The previous catalog of the directory. NULL if none.
+* @param dirpath  The directory
+* @param mtime    The directory modification time before the files were listed
+* @param listed   The time the files began to be listed
+* @param filelist The image files found in the directory, sorted
+* @return IcCatalog*
+*/
+IcCatalog* icUpdateCatalog( const IcCatalog* previous, const string& dirpath, time_t mtime, time_t listed,
+                            const vector<string>& filelist )
+{
+    IcCatalog* catalog = icCreateCatalog( dirpath );
+    catalog->mtime = mtime < listed ? mtime : 0;
+    catalog->dirty = true;
+    catalog->entries.reserve( filelist.size() );
+    map<string, int> interned;
+    size_t p = 0;
+    for( size_t i = 0; i < filelist.size(); i++ )
+    {
+        string name = icPathName( filelist[i] );
+        string::size_type dot = name.find_last_of( '.' );
+        IcCatalogEntry entry = { name, -1, 0, 0 };
+        if( dot != string::npos )
+        {
+            string ext = name.substr( dot + 1 );
+            map<string, int>::iterator iter = interned.find( ext );
+            if( iter == interned.end() )
+            {
+                iter = interned.insert( make_pair( ext, (int)catalog->extensions.size() ) ).first;
+                catalog->extensions.push_back( ext );
+            }
+            entry.stem = name.substr( 0, dot );
+            entry.ext = iter->second;
+        }
+
+        // both are sorted by filename
+        while( previous != NULL && p < previous->entries.size() &&
+               icCatalogEntryName( previous, previous->entries[p] ) < name ) p++;
+        if( previous != NULL && p < previous->entries.size() &&
+            icCatalogEntryName( previous, previous->entries[p] ) == name )
+        {
+            entry.size = previous->entries[p].size;
+            entry.mtime = previous->entries[p].mtime;
+        }
+        else
+        {
+            boost::system::error_code ec;
+            boost::filesystem::path fspath( filelist[i] );
+            entry.size = boost::filesystem::file_size( fspath, ec );
+            if( ec ) entry.size = 0;
+            entry.mtime = boost::filesystem::last_write_time( fspath, ec );
+            if( ec ) entry.mtime = 0;
+        }
+        catalog->entries.push_back( entry );
+    }
+    return catalog;
+}
+
+/**
+* The paths of all cataloged files in order
+*/
+vector<string> icCatalogFilelist( const IcCatalog* catalog )
+{
+    vector<string> filelist;
+    filelist.reserve( catalog->entries.size() );
+    for( size_t i = 0; i < catalog->entries.size(); i++ )
+        filelist.push_back( icCatalogEntryPath( catalog, catalog->entries[i] ) );
+    return filelist;
+}
+
+/**
+* Find the entry of a file. NULL if not cataloged.
+*/
+IcCatalogEntry* icCatalogFind( IcCatalog* catalog, const string& path )
+{
+    string name = icPathName( path );
+    size_t lo = 0, hi = catalog->entries.size();
+    while( lo < hi )
+    {
+        size_t mid = ( lo + hi ) / 2;
+        if( icCatalogEntryName( catalog, catalog->entries[mid] ) < name ) lo = mid + 1;
+        else hi = mid;
+    }
+    if( lo < catalog->entries.size() && icCatalogEntryName( catalog, catalog->entries[lo] ) == name )
+        return &catalog->entries[lo];
+    return NULL;
+}
+
+/**
+* The components of a filename, from its entry if cataloged
+*
+* @param catalog The catalog. May be NULL.
+* @param path    The filename
+*/
+IcPathParts icCatalogSplitPath( IcCatalog* catalog, const string& path )
+{
+    IcCatalogEntry* entry = catalog == NULL ? NULL : icCatalogFind( catalog, path );
+    if( entry == NULL ) return icSplitPath( path );
+    IcPathParts parts;
+    parts.dirname = catalog->dirname;
+    parts.filename = entry->stem;
+    parts.extension = entry->ext < 0 ? "" : catalog->extensions[entry->ext];
+    return parts;
+}
+
+#endif
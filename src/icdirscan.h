@@ -0,0 +1,439 @@
+/** @file
+*
+* Image clipper streaming directory scan
+*
+* A background thread reads a directory and publishes sorted snapshots of the
+* image files found so far, so that the first image can be shown before the
+* whole directory is read. Snapshots are published each time the number of
+* files doubles, which keeps the total cost of merging and copying linear.
+* When the whole directory is read, it is cataloged for the next time.
+* Recursive scans read many directories at once with a work-stealing pool,
+* which hides the latency of network filesystems.
+*
+* The MIT License
+*
+* Copyright (c) 2008, Naotoshi Seo <sonots(at)umd.edu>
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+#ifndef IC_DIRSCAN_INCLUDED
+#define IC_DIRSCAN_INCLUDED
+
+#include <ctype.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <iterator>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+#include <boost/filesystem.hpp>
+#include "filesystem.h"
+#include "iccatalog.h"
+using namespace std;
+
+#define IC_EXTENSION_MAX 15
+
+/**
+* Lowercase filename extensions without dots
+*/
+typedef unordered_set<string> IcExtensionTable;
+
+IcExtensionTable icCreateExtensionTable( const vector<string>& extensions )
+{
+    IcExtensionTable table;
+    for( size_t i = 0; i < extensions.size(); i++ )
+        table.insert( fs::strtolower( extensions[i] ) );
+    return table;
+}
+
+/**
+* Test the extension of a filename against a table without building paths
+*/
+inline bool icMatchExtension( const IcExtensionTable& table, const string& filename )
+{
+    string::size_type dot = filename.find_last_of( "./\\" );
+    if( dot == string::npos || filename[dot] != '.' ) return false;
+    size_t len = filename.size() - dot - 1;
+    if( len == 0 || len > IC_EXTENSION_MAX ) return false;
+    char ext[IC_EXTENSION_MAX + 1];
+    for( size_t i = 0; i < len; i++ )
+        ext[i] = (char)tolower( (unsigned char)filename[dot + 1 + i] );
+    return table.count( string( ext, len ) ) > 0;
+}
+
+bool icGlobMatchFrom( const char* pattern, const char* path )
+{
+    for( ; *pattern; pattern++, path++ )
+    {
+        if( *pattern == '*' )
+        {
+            bool any = ( pattern[1] == '*' );
+            pattern += any ? 2 : 1;
+            for( ; ; path++ )
+            {
+                if( icGlobMatchFrom( pattern, path ) ) return true;
+                if( *path == '\0' || ( !any && *path == '/' ) ) return false;
+            }
+        }
+        if( *path == '\0' ) return false;
+        if( *pattern != *path && !( *pattern == '?' && *path != '/' ) ) return false;
+    }
+    return *path == '\0';
+}
+
+/**
+* Match a path against a glob pattern
+*
+* '*' matches any characters except '/', '**' matches any characters and
+* '?' matches one character except '/'. A pattern without '/' is matched
+* against the last path component only.
+*/
+bool icGlobMatch( const char* pattern, const char* path )
+{
+    if( strchr( pattern, '/' ) == NULL )
+    {
+        const char* name = strrchr( path, '/' );
+        if( name != NULL ) path = name + 1;
+    }
+    return icGlobMatchFrom( pattern, path );
+}
+
+inline bool icGlobMatchAny( const vector<string>& patterns, const string& path )
+{
+    for( size_t i = 0; i < patterns.size(); i++ )
+        if( icGlobMatch( patterns[i].c_str(), path.c_str() ) ) return true;
+    return false;
+}
+
+/**
+* A directory waiting to be read
+*/
+typedef struct IcDirTask {
+    string path;               /**< directory */
+    string relpath;            /**< directory relative to the scanned one, '/' separated */
+} IcDirTask;
+
+/**
+* Directories waiting to be read by one walker. Others steal from the front.
+*/
+typedef struct IcDirQueue {
+    deque<IcDirTask> tasks;
+    mutex lock;
+} IcDirQueue;
+
+/**
+* Directory scan state. Use icCreateDirScan and icReleaseDirScan.
+*/
+typedef struct IcDirScan {
+    string dirpath;                    /**< directory being read */
+    IcExtensionTable extensions;       /**< image file types */
+    bool recursive;                    /**< read subdirectories too */
+    vector<string> include;            /**< globs of files to be read. All if empty */
+    vector<string> exclude;            /**< globs of files and directories not to be read */
+    vector<string> published;          /**< latest sorted snapshot */
+    bool fresh;                        /**< published is not taken yet */
+    bool done;                         /**< the whole directory is read */
+    IcCatalog* catalog;                /**< previous catalog, then the catalog of the files found */
+    atomic<bool> quit;
+    mutex lock;
+    condition_variable cond;
+    thread worker;
+    // walk
+    vector<IcDirQueue> queues;         /**< one per walker */
+    atomic<long> pending;              /**< directories queued or being read */
+    atomic<long> queued;               /**< directories queued */
+    mutex walk_lock;
+    condition_variable walk_cond;      /**< signaled when a directory is queued or all are read */
+    atomic<bool> failed;               /**< a directory was not readable */
+    vector<string> sorted;             /**< files found and merged */
+    vector<string> batch;              /**< files found and not merged yet */
+    mutex merge_lock;                  /**< guards sorted and batch */
+} IcDirScan;
+
+/**
+* Merge the batch of new files into the sorted files and publish a snapshot.
+* Call with merge_lock held.
+*/
+void icDirScanPublish( IcDirScan* scan )
+{
+    sort( scan->batch.begin(), scan->batch.end() );
+    vector<string> merged;
+    merged.reserve( scan->sorted.size() + scan->batch.size() );
+    merge( make_move_iterator( scan->sorted.begin() ), make_move_iterator( scan->sorted.end() ),
+           make_move_iterator( scan->batch.begin() ), make_move_iterator( scan->batch.end() ),
+           back_inserter( merged ) );
+    scan->sorted.swap( merged );
+    scan->batch.clear();
+
+    vector<string> snapshot( scan->sorted );
+    lock_guard<mutex> lk( scan->lock );
+    scan->published.swap( snapshot );
+    scan->fresh = true;
+    scan->cond.notify_all();
+}
+
+/**
+* Add files found to the batch and publish when the number of files doubles
+*/
+void icDirScanAdd( IcDirScan* scan, vector<string>& found )
+{
+    if( found.empty() ) return;
+    lock_guard<mutex> lk( scan->merge_lock );
+    scan->batch.insert( scan->batch.end(), make_move_iterator( found.begin() ), make_move_iterator( found.end() ) );
+    found.clear();
+    if( scan->batch.size() >= max( (size_t)1, scan->sorted.size() ) ) icDirScanPublish( scan );
+}
+
+/**
+* Wake walkers waiting for directories to be queued
+*/
+inline void icDirScanWake( IcDirScan* scan, bool all )
+{
+    lock_guard<mutex> lk( scan->walk_lock );
+    if( all ) scan->walk_cond.notify_all();
+    else scan->walk_cond.notify_one();
+}
+
+/**
+* Read one directory. Subdirectories are queued to the walker.
+*/
+void icDirScanRead( IcDirScan* scan, int walker, const IcDirTask& task )
+{
+    vector<string> found;
+    boost::system::error_code ec;
+    boost::filesystem::directory_iterator iter( boost::filesystem::path( task.path.empty() ? "." : task.path ), ec ), end_iter;
+    for( ; !ec && iter != end_iter && !scan->quit; iter.increment( ec ) )
+    {
+        string name = iter->path().filename().string();
+        string path = task.path.empty() ? name : ( boost::filesystem::path( task.path ) / name ).string();
+        string relpath = task.relpath.empty() ? name : task.relpath + "/" + name;
+        // the file type comes with the directory entry on most systems
+        boost::system::error_code status_ec;
+        boost::filesystem::file_status status = iter->symlink_status( status_ec );
+        if( scan->recursive && boost::filesystem::is_directory( status ) )
+        {
+            if( icGlobMatchAny( scan->exclude, relpath ) ) continue;
+            IcDirTask subdir = { path, relpath };
+            scan->pending++;
+            {
+                lock_guard<mutex> lk( scan->queues[walker].lock );
+                scan->queues[walker].tasks.push_back( subdir );
+                scan->queued++;
+            }
+            icDirScanWake( scan, false );
+            continue;
+        }
+        if( !icMatchExtension( scan->extensions, name ) ) continue;
+        if( boost::filesystem::is_symlink( status ) ) status = iter->status( status_ec );
+        if( !boost::filesystem::is_regular_file( status ) ) continue;
+        if( !scan->include.empty() && !icGlobMatchAny( scan->include, relpath ) ) continue;
+        if( icGlobMatchAny( scan->exclude, relpath ) ) continue;
+        found.push_back( path );
+        // publish the first files of a huge directory early
+        if( found.size() >= 4096 ) icDirScanAdd( scan, found );
+    }
+    if( ec ) scan->failed = true;
+    icDirScanAdd( scan, found );
+}
+
+/**
+* Take a directory from the own queue, or steal one from another walker
+*/
+bool icDirScanNextTask( IcDirScan* scan, int walker, IcDirTask* task )
+{
+    {
+        lock_guard<mutex> lk( scan->queues[walker].lock );
+        if( !scan->queues[walker].tasks.empty() )
+        {
+            *task = scan->queues[walker].tasks.back();
+            scan->queues[walker].tasks.pop_back();
+            scan->queued--;
+            return true;
+        }
+    }
+    for( size_t i = 1; i < scan->queues.size(); i++ )
+    {
+        IcDirQueue& victim = scan->queues[( walker + i ) % scan->queues.size()];
+        lock_guard<mutex> lk( victim.lock );
+        if( !victim.tasks.empty() )
+        {
+            *task = victim.tasks.front();
+            victim.tasks.pop_front();
+            scan->queued--;
+            return true;
+        }
+    }
+    return false;
+}
+
+void icDirScanWalker( IcDirScan* scan, int walker )
+{
+    IcDirTask task;
+    while( scan->pending > 0 && !scan->quit )
+    {
+        if( icDirScanNextTask( scan, walker, &task ) )
+        {
+            icDirScanRead( scan, walker, task );
+            if( --scan->pending == 0 ) icDirScanWake( scan, true );
+        }
+        else
+        {
+            // others are reading directories which may have subdirectories
+            unique_lock<mutex> lk( scan->walk_lock );
+            while( scan->queued == 0 && scan->pending > 0 && !scan->quit ) scan->walk_cond.wait( lk );
+        }
+    }
+}
+
+void icDirScanWorker( IcDirScan* scan )
+{
+    boost::system::error_code ec;
+    time_t mtime = boost::filesystem::last_write_time( boost::filesystem::path( scan->dirpath.empty() ? "." : scan->dirpath ), ec );
+    time_t listed = time( NULL );
+    IcDirTask root = { scan->dirpath, "" };
+    scan->queues[0].tasks.push_back( root );
+    scan->queued = 1;
+    scan->pending = 1;
+    vector<thread> walkers;
+    for( size_t i = 1; i < scan->queues.size(); i++ )
+        walkers.push_back( thread( icDirScanWalker, scan, (int)i ) );
+    icDirScanWalker( scan, 0 );
+    for( size_t i = 0; i < walkers.size(); i++ )
+        walkers[i].join();
+    bool complete = !ec && !scan->failed && !scan->quit;
+    {
+        lock_guard<mutex> lk( scan->merge_lock );
+        icDirScanPublish( scan );
+    }
+
+    // the modification time of the directory tells nothing about its subdirectories
+    IcCatalog* catalog = NULL;
+    if( complete && !scan->recursive && scan->include.empty() && scan->exclude.empty() )
+    {
+        catalog = icUpdateCatalog( scan->catalog, scan->dirpath, mtime, listed, scan->sorted );
+        icWriteCatalog( catalog );
+    }
+    lock_guard<mutex> lk( scan->lock );
+    icReleaseCatalog( &scan->catalog );
+    scan->catalog = catalog;
+    scan->done = true;
+    scan->cond.notify_all();
+}
+
+/**
+* Start reading a directory in background
+*
+* @param dirpath    The directory
+* @param extensions Image file types
+* @param [previous = NULL] The outdated catalog of the directory, whose entries
+*                   are reused. The scan takes ownership.
+* @param [recursive = false] Read subdirectories too.
+*                   Recursive or filtered scans are not cataloged.
+* @param [include = all] Globs of files to be read, relative to dirpath. See icGlobMatch.
+* @param [exclude = none] Globs of files and directories not to be read
+* @param [nthreads = 16] The number of directories read at once when recursive.
+*                   Directory reads mostly wait for the disk or the network,
+*                   so this may exceed the number of cores.
+* @return IcDirScan*
+*/
+IcDirScan* icCreateDirScan( const string& dirpath, const vector<string>& extensions,
+                            IcCatalog* previous = NULL, bool recursive = false,
+                            const vector<string>& include = vector<string>(),
+                            const vector<string>& exclude = vector<string>(), int nthreads = 16 )
+{
+    IcDirScan* scan = new IcDirScan();
+    scan->dirpath = dirpath;
+    scan->extensions = icCreateExtensionTable( extensions );
+    scan->recursive = recursive;
+    scan->include = include;
+    scan->exclude = exclude;
+    scan->fresh = false;
+    scan->done = false;
+    scan->catalog = previous;
+    scan->quit = false;
+    scan->queues = vector<IcDirQueue>( recursive ? max( 1, nthreads ) : 1 );
+    scan->pending = 0;
+    scan->queued = 0;
+    scan->failed = false;
+    scan->worker = thread( icDirScanWorker, scan );
+    return scan;
+}
+
+/**
+* Stop reading. Files not published yet are discarded.
+*/
+void icReleaseDirScan( IcDirScan** scan )
+{
+    if( *scan == NULL ) return;
+    (*scan)->quit = true;
+    icDirScanWake( *scan, true );
+    (*scan)->worker.join();
+    icReleaseCatalog( &(*scan)->catalog );
+    delete *scan;
+    *scan = NULL;
+}
+
+/**
+* Take the latest sorted snapshot of the files found
+*
+* @param scan     The directory scan
+* @param filelist The snapshot. Not modified if nothing new was published.
+* @param [wait = false] Block until a snapshot is published or the scan ends
+* @return false if nothing new was published
+*/
+bool icDirScanTake( IcDirScan* scan, vector<string>& filelist, bool wait = false )
+{
+    unique_lock<mutex> lk( scan->lock );
+    while( wait && !scan->fresh && !scan->done ) scan->cond.wait( lk );
+    if( !scan->fresh ) return false;
+    filelist.swap( scan->published );
+    scan->published.clear();
+    scan->fresh = false;
+    return true;
+}
+
+/**
+* Whether the whole directory is read and taken
+*/
+inline bool icDirScanFinished( IcDirScan* scan )
+{
+    lock_guard<mutex> lk( scan->lock );
+    return scan->done && !scan->fresh;
+}
+
+/**
+* Take the catalog of the files found. NULL if the scan is not finished or failed.
+*/
+IcCatalog* icDirScanTakeCatalog( IcDirScan* scan )
+{
+    lock_guard<mutex> lk( scan->lock );
+    if( !scan->done ) return NULL;
+    IcCatalog* catalog = scan->catalog;
+    scan->catalog = NULL;
+    return catalog;
+}
+
+#endif
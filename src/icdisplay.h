@@ -0,0 +1,300 @@
+/** @file
+*
+* Image clipper display image
+*
+* The MIT License
+*
+* Copyright (c) 2008, Naotoshi Seo <sonots(at)umd.edu>
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+#ifndef IC_DISPLAY_INCLUDED
+#define IC_DISPLAY_INCLUDED
+
+#include "cv.h"
+#include "cxcore.h"
+#include <algorithm>
+using namespace std;
+
+/**
+* Scale factor to fit an image into the screen
+*
+* The image is halved up to 3 times by default.
+*
+* @param size        The image size
+* @param screen_size The screen resolution
+* @param [halvings = 3] The maximum times the image is halved
+* @return float
+*/
+inline float icFitScale( CvSize size, CvSize screen_size, int halvings = 3 )
+{
+    float scale_factor = 1.0f;
+    for( int i = 0; i < halvings; i++ )
+    {
+        if( size.width <= screen_size.width && size.height <= screen_size.height ) break;
+        size.width /= 2;
+        size.height /= 2;
+        scale_factor /= 2;
+    }
+    return scale_factor;
+}
+
+/**
+* Scale an image of more than 8 bits into 8 bits as cvShowImage shows it
+*
+* 16 bits are divided by 256 and float is multiplied by 255.
+*
+* @param img The image
+* @return 8U IplImage* of the same size and channels. Do not forget cvReleaseImage.
+*/
+inline IplImage* icConvertTo8U( const IplImage* img )
+{
+    double scale = ( img->depth & 255 ) == 16 ? 1.0 / 256 : ( img->depth & 255 ) == 32 ? 255.0 : 1.0;
+    IplImage* dst = cvCreateImage( cvGetSize( img ), IPL_DEPTH_8U, img->nChannels );
+    cvConvertScale( img, dst, scale );
+    return dst;
+}
+
+#define IC_PYRAMID_MAX_LEVELS 12
+
+/**
+* Display pyramid of an image
+*
+* Level i is the source halved base + i times. Computed once per image so
+* that zooming resamples only from the nearest level. Levels are 8 bits
+* as they are shown; a deeper source is scaled by icConvertTo8U.
+*/
+typedef struct IcPyramid {
+    int nlevels;                                /**< number of levels */
+    IplImage* levels[IC_PYRAMID_MAX_LEVELS];    /**< levels[0] is the source if not owns_base */
+    CvSize size;                                /**< size of the source */
+    int base;                                   /**< times levels[0] is halved from the source */
+    bool owns_base;                             /**< levels[0] is owned by the pyramid */
+} IcPyramid;
+
+void icPyramidBuild( IcPyramid* pyr, CvSize screen_size )
+{
+    while( pyr->nlevels < IC_PYRAMID_MAX_LEVELS )
+    {
+        IplImage* prev = pyr->levels[pyr->nlevels - 1];
+        if( prev->width / 2 < 1 || prev->height / 2 < 1 ) break;
+        if( prev->width * 4 <= screen_size.width && prev->height * 4 <= screen_size.height ) break;
+        IplImage* next = cvCreateImage( cvSize( prev->width / 2, prev->height / 2 ), prev->depth, prev->nChannels );
+        cvResize( prev, next, CV_INTER_AREA );
+        pyr->levels[pyr->nlevels++] = next;
+    }
+}
+
+/**
+* Create a display pyramid
+*
+* Levels are computed down to a quarter of the screen resolution so that
+* fitting into the screen and zooming out never touch the source.
+*
+* @param src          The source image. Must outlive the pyramid if 8 bits.
+* @param screen_size  The screen resolution
+* @return IcPyramid*
+*/
+IcPyramid* icCreatePyramid( const IplImage* src, CvSize screen_size )
+{
+    IcPyramid* pyr = new IcPyramid();
+    pyr->owns_base = src->depth != IPL_DEPTH_8U;
+    pyr->levels[0] = pyr->owns_base ? icConvertTo8U( src ) : (IplImage*)src;
+    pyr->nlevels = 1;
+    pyr->size = cvGetSize( src );
+    pyr->base = 0;
+    icPyramidBuild( pyr, screen_size );
+    return pyr;
+}
+
+/**
+* Create a display pyramid from a reduced decode of the source
+*
+* A decoder reducing by 2^base rounds the size up while halving rounds down.
+* The partial last column and row are dropped then so that levels have the
+* same sizes as icCreatePyramid would give.
+*
+* @param reduced      The source reduced by 2^base. Owned by the pyramid.
+* @param size         The size of the source
+* @param base         The times the source is halved
+* @param screen_size  The screen resolution
+* @return IcPyramid*
+*/
+IcPyramid* icCreateReducedPyramid( IplImage* reduced, CvSize size, int base, CvSize screen_size )
+{
+    CvSize floor_size = cvSize( max( 1, size.width >> base ), max( 1, size.height >> base ) );
+    if( reduced->width > floor_size.width || reduced->height > floor_size.height )
+    {
+        IplImage* cropped = cvCreateImage( floor_size, reduced->depth, reduced->nChannels );
+        cvSetImageROI( reduced, cvRect( 0, 0, floor_size.width, floor_size.height ) );
+        cvCopy( reduced, cropped );
+        cvReleaseImage( &reduced );
+        reduced = cropped;
+    }
+    IcPyramid* pyr = new IcPyramid();
+    pyr->levels[0] = reduced;
+    pyr->nlevels = 1;
+    pyr->size = size;
+    pyr->base = base;
+    pyr->owns_base = true;
+    icPyramidBuild( pyr, screen_size );
+    return pyr;
+}
+
+void icReleasePyramid( IcPyramid** pyr )
+{
+    if( *pyr == NULL ) return;
+    for( int i = (*pyr)->owns_base ? 0 : 1; i < (*pyr)->nlevels; i++ )
+        cvReleaseImage( &(*pyr)->levels[i] );
+    delete *pyr;
+    *pyr = NULL;
+}
+
+/**
+* Memory held by a pyramid excluding the source
+*/
+inline size_t icPyramidBytes( const IcPyramid* pyr )
+{
+    size_t bytes = 0;
+    if( pyr == NULL ) return bytes;
+    for( int i = pyr->owns_base ? 0 : 1; i < pyr->nlevels; i++ )
+        bytes += pyr->levels[i]->imageSize;
+    return bytes;
+}
+
+/**
+* Render a region of the display image at a scale
+*
+* Returns a pyramid level itself when the scale is a power of 1/2 and the
+* region is the whole level. Otherwise the region is resampled from the
+* nearest finer level into a new image, so that the cost follows the region
+* and not the image size.
+*
+* @param pyr    The display pyramid
+* @param scale  The scale factor relative to the source
+* @param view   The region in display coordinates, i.e., source coordinates times scale
+* @param owned  true if the returned image is new. Do not forget cvReleaseImage then.
+* @param [src = NULL] The source image if the pyramid is reduced and it is decoded
+* @return IplImage* of the view size
+*/
+IplImage* icPyramidRender( const IcPyramid* pyr, float scale, CvRect view, bool* owned, const IplImage* src = NULL )
+{
+    CvSize size = cvSize( pyr->size.width * scale, pyr->size.height * scale );
+    size.width = max( 1, size.width );
+    size.height = max( 1, size.height );
+    int level = 0;
+    while( level + 1 < pyr->nlevels &&
+           pyr->levels[level + 1]->width >= size.width && pyr->levels[level + 1]->height >= size.height )
+        level++;
+    const IplImage* nearest = pyr->levels[level];
+    if( level == 0 && pyr->base > 0 && src != NULL &&
+        ( nearest->width < size.width || nearest->height < size.height ) )
+        nearest = src;
+    if( nearest->width == size.width && nearest->height == size.height )
+    {
+        if( view.x == 0 && view.y == 0 && view.width == size.width && view.height == size.height )
+        {
+            *owned = false;
+            return (IplImage*)nearest;
+        }
+        IplImage* display = cvCreateImage( cvSize( view.width, view.height ), nearest->depth, nearest->nChannels );
+        CvMat sub;
+        cvGetSubRect( nearest, &sub, view );
+        cvCopy( &sub, display );
+        *owned = true;
+        return display;
+    }
+    IplImage* display = cvCreateImage( cvSize( view.width, view.height ), nearest->depth, nearest->nChannels );
+    // display(x, y) = nearest((view.x + x + 0.5) * kx - 0.5, (view.y + y + 0.5) * ky - 0.5)
+    double kx = (double)nearest->width / size.width, ky = (double)nearest->height / size.height;
+    CvMat* map = cvCreateMat( 2, 3, CV_32FC1 );
+    cvZero( map );
+    cvmSet( map, 0, 0, kx );
+    cvmSet( map, 0, 2, ( view.x + 0.5 ) * kx - 0.5 );
+    cvmSet( map, 1, 1, ky );
+    cvmSet( map, 1, 2, ( view.y + 0.5 ) * ky - 0.5 );
+    cvWarpAffine( nearest, display, map, CV_INTER_LINEAR + CV_WARP_FILL_OUTLIERS + CV_WARP_INVERSE_MAP );
+    cvReleaseMat( &map );
+    *owned = true;
+    return display;
+}
+
+/**
+* Visible part of a display image
+*
+* The window shows only this region of the image scaled by the zoom, so
+* that zooming and panning cost the window size, not the image size.
+* Window coordinates plus rect.x, rect.y are display coordinates.
+*/
+typedef struct IcViewport {
+    CvRect rect;               /**< visible region in display coordinates */
+    CvSize max_size;           /**< largest window, e.g., the screen resolution */
+} IcViewport;
+
+inline IcViewport icViewport( CvSize max_size )
+{
+    IcViewport view = { cvRect( 0, 0, 0, 0 ), max_size };
+    return view;
+}
+
+/**
+* Fit the viewport into the display image
+*
+* @param view  The viewport
+* @param size  The source size
+* @param scale The zoom
+*/
+inline void icViewportClamp( IcViewport* view, CvSize size, float scale )
+{
+    CvSize display = cvSize( max( 1, (int)( size.width * scale ) ), max( 1, (int)( size.height * scale ) ) );
+    view->rect.width = min( view->max_size.width, display.width );
+    view->rect.height = min( view->max_size.height, display.height );
+    view->rect.x = max( 0, min( view->rect.x, display.width - view->rect.width ) );
+    view->rect.y = max( 0, min( view->rect.y, display.height - view->rect.height ) );
+}
+
+/**
+* Change the zoom keeping the point under an anchor in place
+*
+* @param view   The viewport
+* @param size   The source size
+* @param from   The current zoom
+* @param to     The new zoom
+* @param anchor The anchor in window coordinates
+*/
+inline void icViewportZoom( IcViewport* view, CvSize size, float from, float to, CvPoint anchor )
+{
+    double k = (double)to / from;
+    view->rect.x = cvRound( ( view->rect.x + anchor.x ) * k ) - anchor.x;
+    view->rect.y = cvRound( ( view->rect.y + anchor.y ) * k ) - anchor.y;
+    icViewportClamp( view, size, to );
+}
+
+/**
+* Move the viewport by display pixels
+*/
+inline void icViewportPan( IcViewport* view, CvSize size, float scale, int dx, int dy )
+{
+    view->rect.x += dx;
+    view->rect.y += dy;
+    icViewportClamp( view, size, scale );
+}
+
+#endif
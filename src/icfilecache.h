@@ -0,0 +1,274 @@
+/** @file
+*
+* Image clipper cache of file contents
+*
+* Compressed files are an order of magnitude smaller than decoded images,
+* so many more of them fit in memory. Keeping the files around the current
+* position of a filelist read ahead makes browsing back and forth decode
+* from memory instead of reading from a slow (network) disk again.
+*
+* Several threads may read through the cache at once, so that many slow
+* reads are in flight together. A file is read once even if requested by
+* several threads. Files about to be read can be hinted to the kernel with
+* posix_fadvise, which starts fetching them in the background.
+*
+* The MIT License
+*
+* Copyright (c) 2008, Naotoshi Seo <sonots(at)umd.edu>
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+#ifndef IC_FILECACHE_INCLUDED
+#define IC_FILECACHE_INCLUDED
+
+#include "cv.h"
+#include "cxcore.h"
+#include "highgui.h"
+#include <stdio.h>
+#include <time.h>
+#ifndef WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#include <condition_variable>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+using namespace std;
+
+/**
+* Contents of a file. Stays valid while held even if dropped from the cache.
+*/
+typedef shared_ptr< const vector<unsigned char> > IcFileBytes;
+
+#define IC_FILECACHE_SKIP_SECONDS 10   /**< a file not kept is tried again after this */
+#define IC_FILECACHE_MAX_SKIPPED 4096  /**< skipped files remembered at most */
+#define IC_FILECACHE_MAX_HINTED 1024   /**< hinted files remembered at most */
+
+typedef struct IcFileCacheItem {
+    IcFileBytes bytes;
+    list<string>::iterator lru;        /**< position in IcFileCache::lru */
+} IcFileCacheItem;
+
+/**
+* LRU cache of file contents. Use icCreateFileCache and icReleaseFileCache.
+*/
+typedef struct IcFileCache {
+    map<string, IcFileCacheItem> files;  /**< contents by filename */
+    list<string> lru;                  /**< filenames, the most recently used first */
+    map<string, time_t> skipped;       /**< files not kept: not readable or too large, until when */
+    set<string> reading;               /**< files being read */
+    set<string> hinted;                /**< files hinted to the kernel and not read yet */
+    size_t bytes;                      /**< bytes held */
+    size_t max_bytes;                  /**< memory ceiling */
+    long hits;                         /**< reads served from memory */
+    long misses;                       /**< reads from disk */
+    mutex lock;
+    condition_variable cond;           /**< signaled when a read finishes */
+} IcFileCache;
+
+/**
+* Create a file cache
+*
+* @param max_bytes The memory ceiling. Files larger than 1/8 of it are not kept.
+* @return IcFileCache*
+*/
+IcFileCache* icCreateFileCache( size_t max_bytes )
+{
+    IcFileCache* cache = new IcFileCache();
+    cache->bytes = 0;
+    cache->max_bytes = max_bytes;
+    cache->hits = 0;
+    cache->misses = 0;
+    return cache;
+}
+
+void icReleaseFileCache( IcFileCache** cache )
+{
+    if( *cache == NULL ) return;
+    delete *cache;
+    *cache = NULL;
+}
+
+/**
+* Look up a file in the cache and mark it as recently used
+*
+* @return IcFileBytes. Empty if not cached.
+*/
+IcFileBytes icFileCacheGet( IcFileCache* cache, const string& path )
+{
+    lock_guard<mutex> lk( cache->lock );
+    map<string, IcFileCacheItem>::iterator iter = cache->files.find( path );
+    if( iter == cache->files.end() ) return IcFileBytes();
+    cache->lru.splice( cache->lru.begin(), cache->lru, iter->second.lru );
+    return iter->second.bytes;
+}
+
+/**
+* The file was not kept lately. Call with the lock held.
+*
+* Skips expire, so that a file briefly not readable, e.g., on a network
+* file system, or replaced by a smaller one is read again. Checking the
+* file itself would stat it with the lock of the caller held.
+*/
+bool icFileCacheSkipped( IcFileCache* cache, const string& path )
+{
+    map<string, time_t>::iterator iter = cache->skipped.find( path );
+    if( iter == cache->skipped.end() ) return false;
+    if( time( NULL ) < iter->second ) return true;
+    cache->skipped.erase( iter );
+    return false;
+}
+
+/**
+* The file was read through the cache, kept or not, or is being read.
+* Marks it as recently used.
+*/
+bool icFileCacheHas( IcFileCache* cache, const string& path )
+{
+    if( icFileCacheGet( cache, path ) ) return true;
+    lock_guard<mutex> lk( cache->lock );
+    return icFileCacheSkipped( cache, path ) || cache->reading.count( path ) > 0;
+}
+
+/**
+* Reading the file through the cache does not wait for the disk, or it is
+* not kept anyway. Marks it as recently used.
+*/
+bool icFileCacheReady( IcFileCache* cache, const string& path )
+{
+    if( icFileCacheGet( cache, path ) ) return true;
+    lock_guard<mutex> lk( cache->lock );
+    return icFileCacheSkipped( cache, path );
+}
+
+/**
+* Tell the kernel that a file is going to be read
+*
+* The kernel starts reading it in the background. A file is hinted once
+* until it is read. Does nothing where posix_fadvise is not available.
+*/
+void icFileCacheHint( IcFileCache* cache, const string& path )
+{
+#ifdef POSIX_FADV_WILLNEED
+    {
+        lock_guard<mutex> lk( cache->lock );
+        if( cache->files.count( path ) || cache->reading.count( path ) || icFileCacheSkipped( cache, path ) )
+            return;
+        // files hinted and never read, e.g., passed over, are forgotten at once
+        if( cache->hinted.size() >= IC_FILECACHE_MAX_HINTED ) cache->hinted.clear();
+        if( !cache->hinted.insert( path ).second ) return;
+    }
+    int fd = open( path.c_str(), O_RDONLY );
+    if( fd < 0 ) return;
+    posix_fadvise( fd, 0, 0, POSIX_FADV_WILLNEED );
+    close( fd );
+#endif
+}
+
+/**
+* Read a file through the cache
+*
+* The least recently used files are dropped to keep the memory ceiling.
+* If another thread is reading the file, waits for it instead of reading
+* it twice.
+*
+* @param cache The file cache
+* @param path  The filename
+* @return IcFileBytes. Empty if not readable, empty or too large to be
+*         kept. Read the file directly then.
+*/
+IcFileBytes icFileCacheRead( IcFileCache* cache, const string& path )
+{
+    unique_lock<mutex> lk( cache->lock );
+    while( cache->reading.count( path ) ) cache->cond.wait( lk );
+    map<string, IcFileCacheItem>::iterator iter = cache->files.find( path );
+    if( iter != cache->files.end() )
+    {
+        cache->lru.splice( cache->lru.begin(), cache->lru, iter->second.lru );
+        cache->hits++;
+        return iter->second.bytes;
+    }
+    cache->reading.insert( path );
+    lk.unlock();
+
+    IcFileBytes bytes;
+    FILE* fp = fopen( path.c_str(), "rb" );
+#ifdef POSIX_FADV_WILLNEED
+    // read the whole file ahead rather than window by window
+    if( fp != NULL ) posix_fadvise( fileno( fp ), 0, 0, POSIX_FADV_WILLNEED );
+#endif
+    long size = ( fp != NULL && fseek( fp, 0, SEEK_END ) == 0 ) ? ftell( fp ) : -1;
+    bool ok = size > 0 && (size_t)size <= cache->max_bytes / 8 && fseek( fp, 0, SEEK_SET ) == 0;
+    if( ok )
+    {
+        vector<unsigned char>* data = new vector<unsigned char>( (size_t)size );
+        ok = ( fread( &(*data)[0], 1, data->size(), fp ) == data->size() );
+        bytes = IcFileBytes( data );
+    }
+    if( fp != NULL ) fclose( fp );
+
+    lk.lock();
+    cache->reading.erase( path );
+    cache->hinted.erase( path );
+    cache->cond.notify_all();
+    if( !ok )
+    {
+        if( cache->skipped.size() >= IC_FILECACHE_MAX_SKIPPED ) cache->skipped.clear();
+        cache->skipped[path] = time( NULL ) + IC_FILECACHE_SKIP_SECONDS;
+        return IcFileBytes();
+    }
+    cache->misses++;
+    while( !cache->lru.empty() && cache->bytes + bytes->size() > cache->max_bytes )
+    {
+        map<string, IcFileCacheItem>::iterator victim = cache->files.find( cache->lru.back() );
+        cache->bytes -= victim->second.bytes->size();
+        cache->files.erase( victim );
+        cache->lru.pop_back();
+    }
+    cache->lru.push_front( path );
+    IcFileCacheItem item = { bytes, cache->lru.begin() };
+    cache->files[path] = item;
+    cache->bytes += bytes->size();
+    return bytes;
+}
+
+/**
+* Decode an image read through the cache as cvLoadImage does
+*
+* Images are decoded in BGR keeping their depth, so that 16 bits and float
+* sources are cropped without being reduced to 8 bits.
+*
+* @return IplImage*. NULL if not loadable. Do not forget cvReleaseImage.
+*/
+IplImage* icFileCacheLoadImage( IcFileCache* cache, const string& path )
+{
+    const int flags = CV_LOAD_IMAGE_ANYDEPTH | CV_LOAD_IMAGE_COLOR;
+    IcFileBytes bytes = icFileCacheRead( cache, path );
+    if( !bytes ) return cvLoadImage( path.c_str(), flags );
+    CvMat buf = cvMat( 1, (int)bytes->size(), CV_8UC1, (void*)&(*bytes)[0] );
+    return cvDecodeImage( &buf, flags );
+}
+
+#endif
@@ -0,0 +1,195 @@
+/** @file
+*
+* Image clipper decoded video frame buffer
+*
+* Keeps copies of decoded video frames under an LRU memory cap. Stepping
+* backward decodes the whole preceding GOP forward once, and the following
+* backward steps are served from memory.
+*
+* The MIT License
+*
+* Copyright (c) 2008, Naotoshi Seo <sonots(at)umd.edu>
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+#ifndef IC_FRAMEBUFFER_INCLUDED
+#define IC_FRAMEBUFFER_INCLUDED
+
+#include "cv.h"
+#include "cxcore.h"
+#include "highgui.h"
+#include <algorithm>
+#include <list>
+#include <map>
+#include "icvideoindex.h"
+using namespace std;
+
+/**
+* A buffered frame
+*/
+typedef struct IcBufferedFrame {
+    IplImage* img;             /**< copy of the decoded frame */
+    list<int>::iterator lru;   /**< position in IcFrameBuffer::lru */
+} IcBufferedFrame;
+
+/**
+* Frame buffer state. Use icCreateFrameBuffer and icReleaseFrameBuffer.
+*/
+typedef struct IcFrameBuffer {
+    CvCapture* cap;                    /**< video reading */
+    const IcVideoIndex* index;         /**< keyframes. NULL if unknown */
+    int pos;                           /**< 0-based frame the capture decodes next. -1 if unknown */
+    int last;                          /**< last requested frame */
+    int gop;                           /**< frames decoded per backward step without keyframes */
+    int pinned;                        /**< frame the caller holds */
+    size_t max_bytes;                  /**< memory cap of buffered frames */
+    size_t bytes;                      /**< memory held by buffered frames */
+    map<int, IcBufferedFrame> frames;
+    list<int> lru;                     /**< frame numbers, most recently used first */
+} IcFrameBuffer;
+
+/**
+* Create a frame buffer
+*
+* @param cap          The capture. Must outlive the buffer.
+* @param index        The video index. Must outlive the buffer. NULL if unknown.
+* @param [max_bytes = 512MB] The memory cap of buffered frames.
+*                     The frame the caller holds is kept even beyond it.
+* @param [gop = 30]   The number of frames decoded per backward step when
+*                     keyframes are unknown
+* @return IcFrameBuffer*
+*/
+IcFrameBuffer* icCreateFrameBuffer( CvCapture* cap, const IcVideoIndex* index,
+                                    size_t max_bytes = (size_t)512 << 20, int gop = 30 )
+{
+    IcFrameBuffer* fb = new IcFrameBuffer();
+    fb->cap = cap;
+    fb->index = index;
+    fb->pos = 0;
+    fb->last = -1;
+    fb->gop = max( 1, gop );
+    fb->pinned = -1;
+    fb->max_bytes = max_bytes;
+    fb->bytes = 0;
+    return fb;
+}
+
+void icReleaseFrameBuffer( IcFrameBuffer** fb )
+{
+    if( *fb == NULL ) return;
+    for( map<int, IcBufferedFrame>::iterator iter = (*fb)->frames.begin(); iter != (*fb)->frames.end(); iter++ )
+        cvReleaseImage( &iter->second.img );
+    delete *fb;
+    *fb = NULL;
+}
+
+/**
+* Drop least recently used frames beyond the memory cap except the given one
+*/
+void icFrameBufferEvict( IcFrameBuffer* fb, int keep )
+{
+    list<int>::iterator iter = fb->lru.end();
+    while( fb->bytes > fb->max_bytes && iter != fb->lru.begin() )
+    {
+        --iter;
+        if( *iter == keep || *iter == fb->pinned ) continue;
+        map<int, IcBufferedFrame>::iterator frame = fb->frames.find( *iter );
+        fb->bytes -= frame->second.img->imageSize;
+        cvReleaseImage( &frame->second.img );
+        fb->frames.erase( frame );
+        iter = fb->lru.erase( iter );
+    }
+}
+
+/**
+* Copy a frame decoded by the capture into the buffer
+*/
+void icFrameBufferStore( IcFrameBuffer* fb, int frame, const IplImage* img )
+{
+    if( fb->frames.find( frame ) != fb->frames.end() ) return;
+    IcBufferedFrame buffered;
+    buffered.img = cvCloneImage( img );
+#if (defined(WIN32) || defined(WIN64)) && (CV_MAJOR_VERSION < 1 || (CV_MAJOR_VERSION == 1 && CV_MINOR_VERSION < 1))
+    buffered.img->origin = 0;
+    cvFlip( buffered.img );
+#endif
+    fb->lru.push_front( frame );
+    buffered.lru = fb->lru.begin();
+    fb->frames[frame] = buffered;
+    fb->bytes += buffered.img->imageSize;
+    icFrameBufferEvict( fb, frame );
+}
+
+/**
+* Decode the frames from the keyframe before a frame up to the frame
+*/
+void icFrameBufferFillGop( IcFrameBuffer* fb, int frame )
+{
+    int start = icVideoKeyframe( fb->index, frame );
+    if( start < 0 ) start = max( 0, frame - fb->gop + 1 );
+    // do not decode more frames than the buffer can hold
+    map<int, IcBufferedFrame>::iterator any = fb->frames.begin();
+    if( any != fb->frames.end() )
+        start = max( start, frame - (int)( fb->max_bytes / any->second.img->imageSize ) + 1 );
+    for( int f = start; f <= frame; f++ )
+    {
+        if( fb->frames.find( f ) != fb->frames.end() ) continue;
+        IplImage* img = icVideoSeek( fb->cap, fb->index, &fb->pos, f );
+        if( img == NULL ) break;
+        icFrameBufferStore( fb, f, img );
+    }
+}
+
+/**
+* Get a frame
+*
+* Moving backward decodes the preceding GOP once. The frame is owned by the
+* buffer and stays valid until the next call. Do not release it.
+*
+* @param fb    The frame buffer
+* @param frame The 0-based frame number
+* @return IplImage*. NULL if not readable.
+*/
+IplImage* icFrameBufferGet( IcFrameBuffer* fb, int frame )
+{
+    if( frame < 0 ) return NULL;
+    map<int, IcBufferedFrame>::iterator iter = fb->frames.find( frame );
+    if( iter == fb->frames.end() )
+    {
+        if( frame < fb->last )
+        {
+            icFrameBufferFillGop( fb, frame );
+        }
+        else
+        {
+            IplImage* img = icVideoSeek( fb->cap, fb->index, &fb->pos, frame );
+            if( img != NULL ) icFrameBufferStore( fb, frame, img );
+        }
+        iter = fb->frames.find( frame );
+        if( iter == fb->frames.end() ) return NULL;
+    }
+    fb->lru.splice( fb->lru.begin(), fb->lru, iter->second.lru );
+    fb->pinned = frame;
+    fb->last = frame;
+    icFrameBufferEvict( fb, frame );
+    return iter->second.img;
+}
+
+#endif
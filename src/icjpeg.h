@@ -0,0 +1,433 @@
+/** @file
+*
+* Image clipper JPEG decoding with libjpeg (HAVE_JPEG)
+*
+* Decodes JPEG images at 1/2, 1/4 or 1/8 resolution by DCT scaling, which
+* skips most of the work of a full decode when the image is shown downscaled.
+* Also decodes only the rows of a region, skipping the scanlines above it
+* (and the columns aside with libjpeg-turbo) and stopping below it.
+* Also crops without decoding at all, copying the DCT coefficients of the
+* blocks under a rectangle aligned to iMCU boundaries as jpegtran -crop.
+* Without libjpeg, the functions fail and callers fall back to cvLoadImage.
+*
+* The MIT License
+*
+* Copyright (c) 2008, Naotoshi Seo <sonots(at)umd.edu>
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+#ifndef IC_JPEG_INCLUDED
+#define IC_JPEG_INCLUDED
+
+#include "cv.h"
+#include "cxcore.h"
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+#ifdef HAVE_JPEG
+#include <setjmp.h>
+extern "C" {
+#include <jpeglib.h>
+}
+#endif
+using namespace std;
+
+#ifdef HAVE_JPEG
+/**
+* libjpeg error manager returning to the caller instead of exit()
+*/
+typedef struct IcJpegError {
+    struct jpeg_error_mgr pub;
+    jmp_buf jump;
+} IcJpegError;
+
+inline void icJpegErrorExit( j_common_ptr cinfo )
+{
+    longjmp( ( (IcJpegError*)cinfo->err )->jump, 1 );
+}
+
+inline void icJpegOutputMessage( j_common_ptr cinfo ) {}
+
+/**
+* Copy decoded scanlines into BGR rows of an image as cvLoadImage does
+*/
+inline void icJpegStoreRow( const JSAMPLE* row, int components, IplImage* img, int y, int x0 = 0, int width = -1 )
+{
+    unsigned char* dst = (unsigned char*)img->imageData + (size_t)y * img->widthStep + x0 * 3;
+    if( width < 0 ) width = img->width;
+    for( int x = 0; x < width; x++, dst += 3 )
+    {
+        if( components == 1 )
+        {
+            dst[0] = dst[1] = dst[2] = row[x];
+        }
+        else
+        {
+            dst[0] = row[3 * x + 2];
+            dst[1] = row[3 * x + 1];
+            dst[2] = row[3 * x];
+        }
+    }
+}
+#endif
+
+#ifdef HAVE_JPEG
+/**
+* Decode a JPEG at a reduced resolution from a file or from memory
+*/
+IplImage* icJpegReduced( FILE* fp, const unsigned char* data, size_t size, int denom )
+{
+    struct jpeg_decompress_struct cinfo;
+    IcJpegError jerr;
+    // assigned after setjmp, so volatile to be valid after longjmp
+    IplImage* volatile img = NULL;
+    JSAMPLE* volatile row = NULL;
+    cinfo.err = jpeg_std_error( &jerr.pub );
+    jerr.pub.error_exit = icJpegErrorExit;
+    jerr.pub.output_message = icJpegOutputMessage;
+    if( setjmp( jerr.jump ) )
+    {
+        IplImage* partial = img;
+        jpeg_destroy_decompress( &cinfo );
+        delete[] row;
+        cvReleaseImage( &partial );
+        return NULL;
+    }
+    jpeg_create_decompress( &cinfo );
+    if( fp != NULL )
+    {
+        jpeg_stdio_src( &cinfo, fp );
+    }
+    else
+    {
+#if JPEG_LIB_VERSION >= 80 || defined( MEM_SRCDST_SUPPORTED )
+        jpeg_mem_src( &cinfo, (unsigned char*)data, (unsigned long)size );
+#else
+        longjmp( jerr.jump, 1 );
+#endif
+    }
+    jpeg_read_header( &cinfo, TRUE );
+    if( cinfo.jpeg_color_space == JCS_CMYK || cinfo.jpeg_color_space == JCS_YCCK )
+        longjmp( jerr.jump, 1 );
+    cinfo.out_color_space = ( cinfo.num_components == 1 ) ? JCS_GRAYSCALE : JCS_RGB;
+    cinfo.scale_num = 1;
+    cinfo.scale_denom = denom;
+    cinfo.dct_method = JDCT_ISLOW;
+    jpeg_start_decompress( &cinfo );
+    img = cvCreateImage( cvSize( cinfo.output_width, cinfo.output_height ), IPL_DEPTH_8U, 3 );
+    row = new JSAMPLE[cinfo.output_width * cinfo.output_components];
+    while( cinfo.output_scanline < cinfo.output_height )
+    {
+        int y = cinfo.output_scanline;
+        JSAMPROW rows[1] = { row };
+        jpeg_read_scanlines( &cinfo, rows, 1 );
+        icJpegStoreRow( row, cinfo.output_components, img, y );
+    }
+    jpeg_finish_decompress( &cinfo );
+    jpeg_destroy_decompress( &cinfo );
+    delete[] row;
+    return img;
+}
+#endif
+
+/**
+* Decode a JPEG file at a reduced resolution
+*
+* The image is ceil( width / denom ) x ceil( height / denom ).
+*
+* @param path  The JPEG filename
+* @param denom 1, 2, 4 or 8
+* @return 8U 3 channels BGR IplImage*. NULL if not decodable this way, e.g.,
+*         not a JPEG, CMYK or no libjpeg. Do not forget cvReleaseImage.
+*/
+IplImage* icLoadJpegReduced( const string& path, int denom )
+{
+#ifdef HAVE_JPEG
+    FILE* fp = fopen( path.c_str(), "rb" );
+    if( fp == NULL ) return NULL;
+    IplImage* img = icJpegReduced( fp, NULL, 0, denom );
+    fclose( fp );
+    return img;
+#else
+    return NULL;
+#endif
+}
+
+/**
+* Decode a JPEG file already read into memory at a reduced resolution
+*
+* @param data  The file contents
+* @param size  The bytes of data
+* @param denom 1, 2, 4 or 8
+* @return 8U 3 channels BGR IplImage*. NULL if not decodable this way, or
+*         libjpeg cannot read from memory. Do not forget cvReleaseImage.
+* @see icLoadJpegReduced
+*/
+IplImage* icDecodeJpegReduced( const unsigned char* data, size_t size, int denom )
+{
+#ifdef HAVE_JPEG
+    return icJpegReduced( NULL, data, size, denom );
+#else
+    return NULL;
+#endif
+}
+
+/**
+* Decode only a region of a JPEG file
+*
+* Scanlines above the region are skipped without being output and decoding
+* stops after its last row, so the cost scales with the region height.
+* With libjpeg-turbo, columns aside are skipped as well. The pixels are the
+* same as the ones of a full decode.
+*
+* @param path The JPEG filename
+* @param rect The region. Outside of the image is black.
+* @return 8U 3 channels BGR IplImage* of the region size. NULL if not
+*         decodable this way. Do not forget cvReleaseImage.
+*/
+IplImage* icLoadJpegRegion( const string& path, CvRect rect )
+{
+#ifdef HAVE_JPEG
+    FILE* fp = fopen( path.c_str(), "rb" );
+    if( fp == NULL ) return NULL;
+    struct jpeg_decompress_struct cinfo;
+    IcJpegError jerr;
+    // assigned after setjmp, so volatile to be valid after longjmp
+    IplImage* volatile img = NULL;
+    JSAMPLE* volatile row = NULL;
+    cinfo.err = jpeg_std_error( &jerr.pub );
+    jerr.pub.error_exit = icJpegErrorExit;
+    jerr.pub.output_message = icJpegOutputMessage;
+    if( setjmp( jerr.jump ) )
+    {
+        IplImage* partial = img;
+        jpeg_destroy_decompress( &cinfo );
+        fclose( fp );
+        delete[] row;
+        cvReleaseImage( &partial );
+        return NULL;
+    }
+    jpeg_create_decompress( &cinfo );
+    jpeg_stdio_src( &cinfo, fp );
+    jpeg_read_header( &cinfo, TRUE );
+    if( cinfo.jpeg_color_space == JCS_CMYK || cinfo.jpeg_color_space == JCS_YCCK )
+        longjmp( jerr.jump, 1 );
+    cinfo.out_color_space = ( cinfo.num_components == 1 ) ? JCS_GRAYSCALE : JCS_RGB;
+    cinfo.dct_method = JDCT_ISLOW;
+    jpeg_start_decompress( &cinfo );
+
+    img = cvCreateImage( cvSize( rect.width, rect.height ), IPL_DEPTH_8U, 3 );
+    cvZero( img );
+    int x1 = min( rect.x + rect.width, (int)cinfo.output_width ), x0 = max( rect.x, 0 );
+    int y1 = min( rect.y + rect.height, (int)cinfo.output_height ), y0 = max( rect.y, 0 );
+    if( x0 < x1 && y0 < y1 )
+    {
+        // first column decoded. Cropping widens the columns to iMCU boundaries.
+        JDIMENSION xoffset = 0, width = cinfo.output_width;
+#if defined( LIBJPEG_TURBO_VERSION_NUMBER ) && LIBJPEG_TURBO_VERSION_NUMBER >= 1005000
+        // one more iMCU aside so that chroma upsampling sees the same neighbors as a full decode
+        int pad = cinfo.max_h_samp_factor * DCTSIZE;
+        xoffset = max( x0 - pad, 0 );
+        width = min( x1 + pad, (int)cinfo.output_width ) - xoffset;
+        jpeg_crop_scanline( &cinfo, &xoffset, &width );
+        jpeg_skip_scanlines( &cinfo, y0 );
+#else
+        row = new JSAMPLE[cinfo.output_width * cinfo.output_components];
+        while( (int)cinfo.output_scanline < y0 )
+        {
+            JSAMPROW rows[1] = { row };
+            jpeg_read_scanlines( &cinfo, rows, 1 );
+        }
+#endif
+        if( row == NULL ) row = new JSAMPLE[cinfo.output_width * cinfo.output_components];
+        while( (int)cinfo.output_scanline < y1 )
+        {
+            int y = cinfo.output_scanline;
+            JSAMPROW rows[1] = { row };
+            jpeg_read_scanlines( &cinfo, rows, 1 );
+            icJpegStoreRow( row + ( x0 - xoffset ) * cinfo.output_components, cinfo.output_components,
+                            img, y - rect.y, x0 - rect.x, x1 - x0 );
+        }
+    }
+    // the rows below are never decoded
+    jpeg_abort_decompress( &cinfo );
+    jpeg_destroy_decompress( &cinfo );
+    fclose( fp );
+    delete[] row;
+    return img;
+#else
+    return NULL;
+#endif
+}
+
+/**
+* DCT coefficients of a JPEG file. Use icOpenJpegCoefficients and
+* icReleaseJpegCoefficients.
+*
+* The header is read on open. The coefficients of the whole image are read
+* on the first crop, once for all of the crops of the file.
+*/
+typedef struct IcJpegCoefficients {
+#ifdef HAVE_JPEG
+    struct jpeg_decompress_struct srcinfo;
+    IcJpegError jerr;
+    FILE* fp;
+    jvirt_barray_ptr* coef;    /**< coefficients of each component. NULL until read. */
+    bool failed;               /**< the coefficients are not readable */
+#endif
+    CvSize size;               /**< image size */
+    CvSize imcu;               /**< iMCU size, 8 or 16 pixels depending on the chroma subsampling */
+} IcJpegCoefficients;
+
+/**
+* Open a JPEG file to crop it losslessly
+*
+* @param path The JPEG filename
+* @return IcJpegCoefficients*. NULL if not a readable JPEG or no libjpeg.
+*         Do not forget icReleaseJpegCoefficients.
+*/
+IcJpegCoefficients* icOpenJpegCoefficients( const string& path )
+{
+#ifdef HAVE_JPEG
+    FILE* fp = fopen( path.c_str(), "rb" );
+    if( fp == NULL ) return NULL;
+    IcJpegCoefficients* c = new IcJpegCoefficients();
+    c->fp = fp;
+    c->coef = NULL;
+    c->failed = false;
+    c->srcinfo.err = jpeg_std_error( &c->jerr.pub );
+    c->jerr.pub.error_exit = icJpegErrorExit;
+    c->jerr.pub.output_message = icJpegOutputMessage;
+    jpeg_create_decompress( &c->srcinfo );
+    if( setjmp( c->jerr.jump ) )
+    {
+        jpeg_destroy_decompress( &c->srcinfo );
+        fclose( c->fp );
+        delete c;
+        return NULL;
+    }
+    jpeg_stdio_src( &c->srcinfo, fp );
+    jpeg_read_header( &c->srcinfo, TRUE );
+    c->size = cvSize( c->srcinfo.image_width, c->srcinfo.image_height );
+    c->imcu = cvSize( c->srcinfo.max_h_samp_factor * DCTSIZE, c->srcinfo.max_v_samp_factor * DCTSIZE );
+    return c;
+#else
+    return NULL;
+#endif
+}
+
+void icReleaseJpegCoefficients( IcJpegCoefficients** c )
+{
+    if( *c == NULL ) return;
+#ifdef HAVE_JPEG
+    jpeg_destroy_decompress( &(*c)->srcinfo );
+    fclose( (*c)->fp );
+#endif
+    delete *c;
+    *c = NULL;
+}
+
+/**
+* Whether a rectangle is losslessly croppable: inside of the image with
+* its top-left on an iMCU boundary. Its size is free.
+*/
+inline bool icJpegLosslessCroppable( const IcJpegCoefficients* c, CvRect rect )
+{
+    return rect.x >= 0 && rect.y >= 0 && rect.width > 0 && rect.height > 0 &&
+        rect.x + rect.width <= c->size.width && rect.y + rect.height <= c->size.height &&
+        rect.x % c->imcu.width == 0 && rect.y % c->imcu.height == 0;
+}
+
+/**
+* Crop a JPEG file losslessly in the DCT domain
+*
+* The coefficients of the blocks under the rectangle are copied to a new
+* JPEG file without decoding nor encoding, so no generation is lost, as
+* jpegtran -crop. The coefficients of the source are entropy decoded once
+* and shared by every crop of it.
+*
+* @param c    The coefficients of the JPEG file
+* @param rect The rectangle. See icJpegLosslessCroppable.
+* @param out  The file to write the cropped JPEG to
+* @return false if not croppable this way, e.g., unaligned, out of the
+*         image or no libjpeg. out may be partially written then.
+*/
+bool icJpegCropLossless( IcJpegCoefficients* c, CvRect rect, FILE* out )
+{
+#ifdef HAVE_JPEG
+    if( c->failed || !icJpegLosslessCroppable( c, rect ) ) return false;
+    struct jpeg_decompress_struct& srcinfo = c->srcinfo;
+    struct jpeg_compress_struct dstinfo;
+    // both share one error manager so that either failure lands here
+    dstinfo.err = &c->jerr.pub;
+    jpeg_create_compress( &dstinfo );
+    if( setjmp( c->jerr.jump ) )
+    {
+        jpeg_destroy_compress( &dstinfo );
+        if( c->coef == NULL ) c->failed = true;
+        return false;
+    }
+    if( c->coef == NULL ) c->coef = jpeg_read_coefficients( &srcinfo );
+    jpeg_copy_critical_parameters( &srcinfo, &dstinfo );
+
+    // blocks of each component under the rectangle, padded to whole iMCUs
+    int nc = srcinfo.num_components;
+    JDIMENSION x_blocks[MAX_COMPONENTS], y_blocks[MAX_COMPONENTS], width[MAX_COMPONENTS], height[MAX_COMPONENTS];
+    jvirt_barray_ptr* dst_coef = (jvirt_barray_ptr*)( *dstinfo.mem->alloc_small )(
+        (j_common_ptr)&dstinfo, JPOOL_IMAGE, sizeof( jvirt_barray_ptr ) * nc );
+    for( int ci = 0; ci < nc; ci++ )
+    {
+        int h = srcinfo.comp_info[ci].h_samp_factor, v = srcinfo.comp_info[ci].v_samp_factor;
+        x_blocks[ci] = rect.x / c->imcu.width * h;
+        y_blocks[ci] = rect.y / c->imcu.height * v;
+        width[ci] = ( rect.width + c->imcu.width - 1 ) / c->imcu.width * h;
+        height[ci] = ( rect.height + c->imcu.height - 1 ) / c->imcu.height * v;
+        dst_coef[ci] = ( *dstinfo.mem->request_virt_barray )( (j_common_ptr)&dstinfo, JPOOL_IMAGE, FALSE,
+                                                              width[ci], height[ci], (JDIMENSION)v );
+    }
+    // jpeg_write_coefficients realizes only the arrays not realized yet
+    ( *dstinfo.mem->realize_virt_arrays )( (j_common_ptr)&dstinfo );
+    for( int ci = 0; ci < nc; ci++ )
+    {
+        for( JDIMENSION y = 0; y < height[ci]; y++ )
+        {
+            JBLOCKARRAY src_row = ( *srcinfo.mem->access_virt_barray )(
+                (j_common_ptr)&srcinfo, c->coef[ci], y_blocks[ci] + y, 1, FALSE );
+            JBLOCKARRAY dst_row = ( *dstinfo.mem->access_virt_barray )(
+                (j_common_ptr)&dstinfo, dst_coef[ci], y, 1, TRUE );
+            memcpy( dst_row[0], src_row[0] + x_blocks[ci], width[ci] * sizeof( JBLOCK ) );
+        }
+    }
+
+    dstinfo.image_width = rect.width;
+    dstinfo.image_height = rect.height;
+    dstinfo.optimize_coding = TRUE;
+    jpeg_stdio_dest( &dstinfo, out );
+    jpeg_write_coefficients( &dstinfo, dst_coef );
+    jpeg_finish_compress( &dstinfo );
+    jpeg_destroy_compress( &dstinfo );
+    return true;
+#else
+    return false;
+#endif
+}
+
+#endif
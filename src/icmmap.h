@@ -0,0 +1,279 @@
+/** @file
+*
+* Image clipper memory-mapped image source
+*
+* Uncompressed PGM, PPM and BMP files are mapped into memory instead of
+* being read as a whole. When the stored pixels are already laid out as
+* an IplImage (8 bits gray PGM, top-down 24 bits BMP) an IplImage header
+* wraps the mapping without a copy. Otherwise only the rows under a region
+* are converted. Either way, a crop touches only the pages under it.
+*
+* The MIT License
+*
+* Copyright (c) 2008, Naotoshi Seo <sonots(at)umd.edu>
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+#ifndef IC_MMAP_INCLUDED
+#define IC_MMAP_INCLUDED
+
+#include "cv.h"
+#include "cxcore.h"
+#include <string.h>
+#include <string>
+#ifndef WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#include "icprobe.h"
+#include "icsurface.h"
+#include "opencvx/cvrect32f.h"
+#include "opencvx/cvcropimageroi.h"
+using namespace std;
+
+#define IC_MAPPED_GRAY     0   /**< 8 bits gray */
+#define IC_MAPPED_GRAY16BE 1   /**< 16 bits big endian gray */
+#define IC_MAPPED_RGB      2   /**< 8 bits RGB */
+#define IC_MAPPED_BGR      3   /**< 8 bits BGR */
+#define IC_MAPPED_BGRX     4   /**< 8 bits BGR and a padding byte */
+#define IC_MAPPED_RGB16BE  5   /**< 16 bits big endian RGB */
+
+/**
+* Memory-mapped image. Use icMapImage and icReleaseMappedImage.
+*/
+typedef struct IcMappedImage {
+    void* map;                 /**< the whole file mapped read only */
+    size_t length;             /**< bytes mapped */
+    CvSize size;               /**< image size */
+    int channels;              /**< channels of the images read: 1 for gray, 3 for BGR */
+    int depth;                 /**< depth of the images read: IPL_DEPTH_16U for 16 bits PNM, else IPL_DEPTH_8U */
+    int layout;                /**< IC_MAPPED_GRAY, _GRAY16BE, _RGB, _RGB16BE, _BGR or _BGRX */
+    int bpp;                   /**< bytes per stored pixel */
+    const unsigned char* data; /**< the first stored row */
+    size_t step;               /**< bytes between stored rows */
+    bool bottom_up;            /**< the first stored row is the bottom row */
+    IplImage* header;          /**< zero copy view of the pixels. NULL if the stored layout is not IplImage's. */
+} IcMappedImage;
+
+/**
+* Locate the pixels of an uncompressed BMP in memory
+*/
+bool icMapBMP( IcMappedImage* m )
+{
+    const unsigned char* buf = (const unsigned char*)m->map;
+    // file header(14) header size(4) width(4) height(4) planes(2) bit_count(2) compression(4)
+    if( m->length < 34 || icProbeLE32( buf + 14 ) < 40 ) return false;
+    int width = (int)icProbeLE32( buf + 18 ), height = (int)icProbeLE32( buf + 22 );
+    int bit_count = (int)icProbeLE16( buf + 28 );
+    if( icProbeLE32( buf + 30 ) != 0 || ( bit_count != 24 && bit_count != 32 ) ) return false; // BI_RGB only
+    m->size = cvSize( width, abs( height ) );
+    m->bottom_up = height > 0;
+    m->channels = 3;
+    m->depth = IPL_DEPTH_8U;
+    m->layout = bit_count == 24 ? IC_MAPPED_BGR : IC_MAPPED_BGRX;
+    m->bpp = bit_count / 8;
+    m->data = buf + icProbeLE32( buf + 10 );
+    m->step = ( (size_t)width * m->bpp + 3 ) & ~(size_t)3;
+    return true;
+}
+
+/**
+* Locate the pixels of a binary PGM or PPM in memory
+*/
+bool icMapPNM( IcMappedImage* m )
+{
+    const unsigned char* buf = (const unsigned char*)m->map;
+    IcImageInfo info;
+    size_t offset;
+    if( !icParsePNM( buf, m->length, &info, &offset ) || ( buf[1] != '5' && buf[1] != '6' ) ) return false;
+    m->size = cvSize( info.width, info.height );
+    m->bottom_up = false;
+    m->channels = info.channels;
+    m->depth = info.depth == 16 ? IPL_DEPTH_16U : IPL_DEPTH_8U;
+    if( info.channels == 3 ) m->layout = info.depth == 16 ? IC_MAPPED_RGB16BE : IC_MAPPED_RGB;
+    else m->layout = info.depth == 16 ? IC_MAPPED_GRAY16BE : IC_MAPPED_GRAY;
+    m->bpp = info.channels * info.depth / 8;
+    m->data = buf + offset;
+    m->step = (size_t)info.width * m->bpp;
+    return true;
+}
+
+void icReleaseMappedImage( IcMappedImage** m )
+{
+    if( *m == NULL ) return;
+    if( (*m)->header ) cvReleaseImageHeader( &(*m)->header );
+#ifndef WIN32
+    munmap( (*m)->map, (*m)->length );
+#endif
+    delete *m;
+    *m = NULL;
+}
+
+/**
+* Map an uncompressed image file into memory
+*
+* @param path The image filename
+* @return IcMappedImage*. NULL if not a binary PGM, PPM or an uncompressed
+*         24 or 32 bits BMP, or memory mapping is not available.
+*/
+IcMappedImage* icMapImage( const string& path )
+{
+#ifndef WIN32
+    int fd = open( path.c_str(), O_RDONLY );
+    if( fd < 0 ) return NULL;
+    struct stat st;
+    if( fstat( fd, &st ) != 0 || st.st_size < 16 )
+    {
+        close( fd );
+        return NULL;
+    }
+    void* map = mmap( NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+    close( fd );
+    if( map == MAP_FAILED ) return NULL;
+    // crops touch a few rows scattered over the file
+    madvise( map, (size_t)st.st_size, MADV_RANDOM );
+
+    IcMappedImage* m = new IcMappedImage();
+    m->map = map;
+    m->length = (size_t)st.st_size;
+    m->header = NULL;
+    const unsigned char* buf = (const unsigned char*)map;
+    bool ok = ( buf[0] == 'B' && buf[1] == 'M' ) ? icMapBMP( m ) : icMapPNM( m );
+    ok = ok && m->size.width > 0 && m->size.height > 0 && m->data >= buf &&
+        (size_t)( m->data - buf ) + m->step * ( m->size.height - 1 ) + (size_t)m->size.width * m->bpp <= m->length;
+    if( !ok )
+    {
+        icReleaseMappedImage( &m );
+        return NULL;
+    }
+    if( !m->bottom_up && ( m->layout == IC_MAPPED_GRAY || m->layout == IC_MAPPED_BGR ) )
+    {
+        m->header = cvCreateImageHeader( m->size, IPL_DEPTH_8U, m->channels );
+        cvSetData( m->header, (void*)m->data, (int)m->step );
+    }
+    return m;
+#else
+    return NULL;
+#endif
+}
+
+/**
+* Read a region of a mapped image
+*
+* Only the stored rows under the region are touched.
+*
+* @param m    The mapped image
+* @param rect The region. Outside of the image is black.
+* @return IplImage* of the region size and of the depth of m. Do not forget cvReleaseImage.
+*/
+IplImage* icMappedRead( const IcMappedImage* m, CvRect rect )
+{
+    IplImage* region = cvCreateImage( cvSize( rect.width, rect.height ), m->depth, m->channels );
+    cvZero( region );
+    CvRect in = icIntersectRect( rect, cvRect( 0, 0, m->size.width, m->size.height ) );
+    for( int y = in.y; y < in.y + in.height; y++ )
+    {
+        const unsigned char* src = m->data + m->step * ( m->bottom_up ? m->size.height - 1 - y : y ) + (size_t)in.x * m->bpp;
+        unsigned char* dst = (unsigned char*)region->imageData + (size_t)( y - rect.y ) * region->widthStep
+            + ( in.x - rect.x ) * m->channels * ( ( m->depth & 255 ) / 8 );
+        ushort* dst16 = (ushort*)dst;
+        switch( m->layout )
+        {
+        case IC_MAPPED_GRAY:
+        case IC_MAPPED_BGR:
+            memcpy( dst, src, (size_t)in.width * m->bpp );
+            break;
+        case IC_MAPPED_GRAY16BE:
+            for( int x = 0; x < in.width; x++ ) dst16[x] = (ushort)( ( src[2 * x] << 8 ) | src[2 * x + 1] );
+            break;
+        case IC_MAPPED_RGB16BE:
+            for( int x = 0; x < in.width; x++, dst16 += 3, src += 6 )
+            {
+                dst16[0] = (ushort)( ( src[4] << 8 ) | src[5] );
+                dst16[1] = (ushort)( ( src[2] << 8 ) | src[3] );
+                dst16[2] = (ushort)( ( src[0] << 8 ) | src[1] );
+            }
+            break;
+        case IC_MAPPED_RGB:
+            for( int x = 0; x < in.width; x++, dst += 3, src += 3 )
+            {
+                dst[0] = src[2]; dst[1] = src[1]; dst[2] = src[0];
+            }
+            break;
+        case IC_MAPPED_BGRX:
+            for( int x = 0; x < in.width; x++, dst += 3, src += 4 )
+            {
+                dst[0] = src[0]; dst[1] = src[1]; dst[2] = src[2];
+            }
+            break;
+        }
+    }
+    return region;
+}
+
+/**
+* Crop a rotated and sheared rectangle from a mapped image
+*
+* Gray images are cropped in gray and then expanded to BGR, so that crops
+* come out as the ones of images decoded by cvLoadImage.
+*
+* @param m       The mapped image
+* @param rect32f The rectangle
+* @param shear   The shear deformation
+* @param [interpolation = CV_INTER_NN] The sampling. See cvCropImageROI.
+* @return 3 channels BGR IplImage* of the rectangle size and of the depth of m.
+*         Do not forget cvReleaseImage.
+* @see cvCropImageROI
+*/
+IplImage* icMappedCrop( const IcMappedImage* m, CvRect32f rect32f, CvPoint2D32f shear,
+                        int interpolation = CV_INTER_NN )
+{
+    CvRect rect = cvRectFromRect32f( rect32f );
+    IplImage* crop = cvCreateImage( cvSize( rect.width, rect.height ), m->depth, m->channels );
+    if( m->header != NULL )
+    {
+        cvCropImageROI( m->header, crop, rect32f, shear, interpolation );
+    }
+    else
+    {
+        CvRect bound = icCropSourceRect( rect32f, shear, interpolation, m->size );
+        if( bound.width > 0 && bound.height > 0 )
+        {
+            IplImage* region = icMappedRead( m, bound );
+            rect32f.x -= bound.x;
+            rect32f.y -= bound.y;
+            cvCropImageROI( region, crop, rect32f, shear, interpolation );
+            cvReleaseImage( &region );
+        }
+        else cvZero( crop );
+    }
+    if( crop->nChannels == 1 )
+    {
+        IplImage* bgr = cvCreateImage( cvGetSize( crop ), crop->depth, 3 );
+        cvCvtColor( crop, bgr, CV_GRAY2BGR );
+        cvReleaseImage( &crop );
+        crop = bgr;
+    }
+    return crop;
+}
+
+#endif
@@ -0,0 +1,137 @@
+/** @file
+*
+* Image clipper PNG decoding with libpng (HAVE_PNG)
+*
+* Decodes PNG images row by row and stops after the last row of a region,
+* so that a crop near the top of a tall image does not inflate the rest.
+* Without libpng, the functions fail and callers fall back to cvLoadImage.
+*
+* The MIT License
+*
+* Copyright (c) 2008, Naotoshi Seo <sonots(at)umd.edu>
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+#ifndef IC_PNG_INCLUDED
+#define IC_PNG_INCLUDED
+
+#include "cv.h"
+#include "cxcore.h"
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+#ifdef HAVE_PNG
+#include <png.h>
+#endif
+using namespace std;
+
+#ifdef HAVE_PNG
+inline void icPngErrorExit( png_structp png_ptr, png_const_charp )
+{
+    png_longjmp( png_ptr, 1 );
+}
+
+inline void icPngWarning( png_structp, png_const_charp ) {}
+#endif
+
+/**
+* Decode only the rows of a PNG file down to the last row of a region
+*
+* Rows are decoded in order and decoding stops after the last row of the
+* region, so the cost scales with the bottom of the region instead of the
+* image height. The pixels are the ones cvLoadImage decodes with
+* CV_LOAD_IMAGE_ANYDEPTH | CV_LOAD_IMAGE_COLOR: 16 bits are kept, palette
+* and gray are expanded to BGR, alpha is dropped.
+*
+* @param path The PNG filename
+* @param rect The region. Outside of the image is black.
+* @return 3 channels BGR IplImage* of the region size, 16U for 16 bits and
+*         8U otherwise. NULL if not decodable this way, e.g., interlaced or
+*         no libpng. Do not forget cvReleaseImage.
+*/
+IplImage* icLoadPngRegion( const string& path, CvRect rect )
+{
+#ifdef HAVE_PNG
+    FILE* fp = fopen( path.c_str(), "rb" );
+    if( fp == NULL ) return NULL;
+    png_structp png_ptr = png_create_read_struct( PNG_LIBPNG_VER_STRING, NULL, icPngErrorExit, icPngWarning );
+    png_infop info_ptr = png_ptr ? png_create_info_struct( png_ptr ) : NULL;
+    // assigned after setjmp, so volatile to be valid after longjmp
+    IplImage* volatile img = NULL;
+    png_byte* volatile row = NULL;
+    if( info_ptr == NULL || setjmp( png_jmpbuf( png_ptr ) ) )
+    {
+        IplImage* partial = img;
+        png_destroy_read_struct( &png_ptr, &info_ptr, NULL );
+        fclose( fp );
+        delete[] row;
+        cvReleaseImage( &partial );
+        return NULL;
+    }
+    png_init_io( png_ptr, fp );
+    png_read_info( png_ptr, info_ptr );
+    int width = (int)png_get_image_width( png_ptr, info_ptr );
+    int height = (int)png_get_image_height( png_ptr, info_ptr );
+    int color_type = png_get_color_type( png_ptr, info_ptr );
+    // every pass of an interlaced image spans all of the rows
+    if( png_get_interlace_type( png_ptr, info_ptr ) != PNG_INTERLACE_NONE )
+        png_longjmp( png_ptr, 1 );
+    int depth = png_get_bit_depth( png_ptr, info_ptr ) > 8 ? IPL_DEPTH_16U : IPL_DEPTH_8U;
+    const int one = 1;
+    // PNG stores 16 bits big endian
+    if( depth == IPL_DEPTH_16U && *(const char*)&one == 1 ) png_set_swap( png_ptr );
+    png_set_strip_alpha( png_ptr );
+    if( color_type == PNG_COLOR_TYPE_PALETTE ) png_set_palette_to_rgb( png_ptr );
+    if( ( color_type & PNG_COLOR_MASK_COLOR ) == 0 )
+    {
+        png_set_expand_gray_1_2_4_to_8( png_ptr );
+        png_set_gray_to_rgb( png_ptr );
+    }
+    png_set_bgr( png_ptr );
+    png_read_update_info( png_ptr, info_ptr );
+
+    img = cvCreateImage( cvSize( rect.width, rect.height ), depth, 3 );
+    cvZero( img );
+    int pixsize = ( depth & 255 ) / 8 * 3;
+    int x1 = min( rect.x + rect.width, width ), x0 = max( rect.x, 0 );
+    int y1 = min( rect.y + rect.height, height ), y0 = max( rect.y, 0 );
+    if( x0 < x1 && y0 < y1 )
+    {
+        row = new png_byte[png_get_rowbytes( png_ptr, info_ptr )];
+        for( int y = 0; y < y1; y++ )
+        {
+            png_read_row( png_ptr, row, NULL );
+            if( y >= y0 )
+                memcpy( img->imageData + (size_t)( y - rect.y ) * img->widthStep + ( x0 - rect.x ) * pixsize,
+                        row + x0 * pixsize, ( x1 - x0 ) * pixsize );
+        }
+    }
+    // the rows below are never inflated
+    png_destroy_read_struct( &png_ptr, &info_ptr, NULL );
+    fclose( fp );
+    delete[] row;
+    return img;
+#else
+    return NULL;
+#endif
+}
+
+#endif
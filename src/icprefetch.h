@@ -0,0 +1,623 @@
+/** @file
+*
+* Image clipper decode-ahead prefetcher
+*
+* A background thread keeps images around the current position of a filelist
+* decoded together with their display pyramids, so that navigation only swaps
+* pointers. Images navigated away from are kept while the memory ceiling
+* allows, the least recently used dropped first.
+*
+* Behind the decoded images, a larger window of files is read ahead into a
+* cache of file contents by a small pool of I/O threads, so that many slow
+* (network) reads are in flight at once and decoding never waits for the
+* disk. Files just beyond the reads in flight are hinted to the kernel.
+*
+* The MIT License
+*
+* Copyright (c) 2008, Naotoshi Seo <sonots(at)umd.edu>
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+#ifndef IC_PREFETCH_INCLUDED
+#define IC_PREFETCH_INCLUDED
+
+#include "cv.h"
+#include "cxcore.h"
+#include "highgui.h"
+#include <algorithm>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+#include "filesystem.h"
+#include "icdisplay.h"
+#include "icfilecache.h"
+#include "icjpeg.h"
+#include "icprobe.h"
+#include "ictiled.h"
+using namespace std;
+
+#define IC_PREFETCH_EMPTY   0
+#define IC_PREFETCH_LOADING 1
+#define IC_PREFETCH_READY   2
+#define IC_PREFETCH_FAILED  3
+
+#define IC_PREFETCH_READ_AHEAD  64  /**< number of next files read ahead into the file cache */
+#define IC_PREFETCH_READ_BEHIND 32  /**< number of previous files kept in the file cache */
+#define IC_PREFETCH_READERS     4   /**< number of I/O threads reading files at once */
+#define IC_PREFETCH_HINTS       8   /**< number of files hinted beyond the ones being read */
+
+/**
+* A decoded filelist entry
+*/
+typedef struct IcPrefetchEntry {
+    int state;                 /**< IC_PREFETCH_EMPTY, _LOADING, _READY or _FAILED */
+    IplImage* img_src;         /**< decoded image. NULL until source_state is _READY. */
+    IcPyramid* pyramid;        /**< display pyramid of img_src */
+    float scale_factor;        /**< scale factor to fit screen */
+    int source_state;          /**< state of img_src. The pyramid may come from a reduced decode. */
+    bool want_source;          /**< img_src is requested to the background thread */
+    IcTiledImage* tiled;       /**< tiles of a large TIFF. img_src is never decoded then. */
+    long used;                 /**< when the entry was decoded or navigated to last */
+} IcPrefetchEntry;
+
+/**
+* Prefetcher state. Use icCreatePrefetch and icReleasePrefetch.
+*/
+typedef struct IcPrefetch {
+    vector<string>* filelist;          /**< files to be read */
+    CvSize screen_size;                /**< screen resolution */
+    int ahead;                         /**< number of next entries kept decoded */
+    int behind;                        /**< number of previous entries kept decoded */
+    size_t max_bytes;                  /**< memory ceiling of decoded entries */
+    size_t bytes;                      /**< memory held by decoded entries */
+    IcFileCache* files;                /**< contents of the files around the current index */
+    long clock;                        /**< counter of IcPrefetchEntry::used */
+    long current;                      /**< index being navigated to */
+    long pinned;                       /**< index whose images the caller holds */
+    map<long, IcPrefetchEntry> entries;
+    long hits;                         /**< navigations served from memory */
+    long misses;                       /**< navigations waiting for a decode */
+    bool quit;
+    mutex lock;
+    condition_variable cond;
+    thread worker;                     /**< decoder */
+    vector<thread> readers;            /**< I/O pool reading files into the file cache */
+    set<string> reading;               /**< files taken by readers */
+} IcPrefetch;
+
+inline size_t icPrefetchEntryBytes( const IcPrefetchEntry& entry )
+{
+    size_t bytes = 0;
+    if( entry.img_src ) bytes += entry.img_src->imageSize;
+    bytes += icPyramidBytes( entry.pyramid );
+    return bytes;
+}
+
+/**
+* The entry may not be dropped nor moved
+*/
+inline bool icPrefetchBusy( const IcPrefetchEntry& entry )
+{
+    return entry.state == IC_PREFETCH_LOADING || entry.source_state == IC_PREFETCH_LOADING;
+}
+
+/**
+* Priority of an index relative to the current one. Smaller is sooner.
+* -1 if out of the prefetch window.
+*/
+inline long icPrefetchRank( const IcPrefetch* p, long index )
+{
+    long d = index - p->current;
+    if( d > p->ahead || -d > p->behind ) return -1;
+    return d > 0 ? 2 * d - 1 : -2 * d;
+}
+
+/**
+* Decode a file read through the file cache and create its display pyramid
+*
+* A JPEG shown downscaled is decoded at the reduced size by DCT scaling.
+* img_src is left to icPrefetchSource then. A large TIFF is opened as tiles
+* and only its overview is decoded.
+*/
+IcPrefetchEntry icPrefetchDecode( const string& filename, CvSize screen_size, IcFileCache* files )
+{
+    IcPrefetchEntry entry = { IC_PREFETCH_FAILED, NULL, NULL, 1.0f, IC_PREFETCH_FAILED, false, NULL, 0 };
+    IcFileBytes bytes = icFileCacheRead( files, fs::realpath( filename ) );
+    IcImageInfo info;
+    bool probed = bytes ? icProbeMemory( &(*bytes)[0], bytes->size(), &info )
+                        : icProbeImage( fs::realpath( filename ), &info );
+    if( probed && info.format == IC_PROBE_TIFF && (double)info.width * info.height >= IC_TILED_MIN_PIXELS )
+    {
+        CvSize size = cvSize( info.width, info.height );
+        float scale_factor = icFitScale( size, screen_size, IC_PYRAMID_MAX_LEVELS );
+        int base = 0;
+        while( ( 1 << base ) * scale_factor < 1.0f ) base++;
+        entry.tiled = base > 0 ? icOpenTiledImage( fs::realpath( filename ) ) : NULL;
+        if( entry.tiled != NULL )
+        {
+            IplImage* overview = icTiledRender( entry.tiled, cvRect( 0, 0, size.width * scale_factor, size.height * scale_factor ),
+                                                scale_factor );
+            entry.pyramid = icCreateReducedPyramid( overview, size, base, screen_size );
+            entry.scale_factor = scale_factor;
+            entry.state = IC_PREFETCH_READY;
+            return entry;
+        }
+    }
+    else if( probed && info.format == IC_PROBE_JPEG )
+    {
+        CvSize size = cvSize( info.width, info.height );
+        float scale_factor = icFitScale( size, screen_size );
+        int base = 0;
+        while( ( 1 << base ) * scale_factor < 1.0f ) base++;
+        IplImage* reduced = NULL;
+        if( base > 0 && bytes ) reduced = icDecodeJpegReduced( &(*bytes)[0], bytes->size(), 1 << base );
+        if( base > 0 && !reduced ) reduced = icLoadJpegReduced( fs::realpath( filename ), 1 << base );
+        if( reduced != NULL )
+        {
+            entry.pyramid = icCreateReducedPyramid( reduced, size, base, screen_size );
+            entry.scale_factor = scale_factor;
+            entry.state = IC_PREFETCH_READY;
+            entry.source_state = IC_PREFETCH_EMPTY;
+            return entry;
+        }
+    }
+    entry.img_src = icFileCacheLoadImage( files, fs::realpath( filename ) );
+    if( entry.img_src != NULL )
+    {
+        entry.pyramid = icCreatePyramid( entry.img_src, screen_size );
+        entry.scale_factor = icFitScale( cvGetSize( entry.img_src ), screen_size );
+        entry.state = IC_PREFETCH_READY;
+        entry.source_state = IC_PREFETCH_READY;
+    }
+    return entry;
+}
+
+void icPrefetchDrop( IcPrefetch* p, map<long, IcPrefetchEntry>::iterator iter )
+{
+    p->bytes -= icPrefetchEntryBytes( iter->second );
+    icReleasePyramid( &iter->second.pyramid );
+    cvReleaseImage( &iter->second.img_src );
+    icReleaseTiledImage( &iter->second.tiled );
+    p->entries.erase( iter );
+}
+
+/**
+* The least recently used entry out of the window. end() if none.
+* Call with the lock held.
+*/
+map<long, IcPrefetchEntry>::iterator icPrefetchLeastUsed( IcPrefetch* p )
+{
+    map<long, IcPrefetchEntry>::iterator least = p->entries.end();
+    for( map<long, IcPrefetchEntry>::iterator iter = p->entries.begin(); iter != p->entries.end(); iter++ )
+    {
+        if( icPrefetchBusy( iter->second ) ) continue;
+        if( iter->first == p->current || iter->first == p->pinned ) continue;
+        if( icPrefetchRank( p, iter->first ) >= 0 ) continue;
+        if( least == p->entries.end() || iter->second.used < least->second.used ) least = iter;
+    }
+    return least;
+}
+
+/**
+* Drop the least recently used entries out of the window beyond the memory
+* ceiling. Call with the lock held.
+*/
+void icPrefetchEvict( IcPrefetch* p )
+{
+    while( p->bytes > p->max_bytes )
+    {
+        map<long, IcPrefetchEntry>::iterator least = icPrefetchLeastUsed( p );
+        if( least == p->entries.end() ) break;
+        icPrefetchDrop( p, least );
+    }
+}
+
+/**
+* The most urgent index not decoded yet whose file is read. -1 if the window
+* is complete or waits for reads. Call with the lock held.
+*/
+long icPrefetchNext( IcPrefetch* p )
+{
+    long size = (long)p->filelist->size();
+    for( long d = 0; d <= max( p->ahead, p->behind ); d++ )
+    {
+        long candidates[2] = { p->current + d, p->current - d };
+        for( int i = 0; i < ( d == 0 ? 1 : 2 ); i++ )
+        {
+            long index = candidates[i];
+            if( index < 0 || index >= size || icPrefetchRank( p, index ) < 0 ) continue;
+            if( p->entries.find( index ) == p->entries.end() &&
+                icFileCacheReady( p->files, fs::realpath( (*p->filelist)[index] ) ) ) return index;
+        }
+    }
+    return -1;
+}
+
+/**
+* Make room for the index by dropping entries out of the window, the least
+* recently used first, then less urgent entries. Call with the lock held.
+*
+* @return false if the memory ceiling is reached by more urgent entries
+*/
+bool icPrefetchMakeRoom( IcPrefetch* p, long index )
+{
+    long rank = icPrefetchRank( p, index );
+    while( p->bytes >= p->max_bytes )
+    {
+        map<long, IcPrefetchEntry>::iterator worst = icPrefetchLeastUsed( p );
+        if( worst != p->entries.end() )
+        {
+            icPrefetchDrop( p, worst );
+            continue;
+        }
+        for( map<long, IcPrefetchEntry>::iterator iter = p->entries.begin(); iter != p->entries.end(); iter++ )
+        {
+            if( icPrefetchBusy( iter->second ) ) continue;
+            if( iter->first == p->current || iter->first == p->pinned ) continue;
+            if( worst == p->entries.end() || icPrefetchRank( p, iter->first ) > icPrefetchRank( p, worst->first ) )
+                worst = iter;
+        }
+        if( worst == p->entries.end() || icPrefetchRank( p, worst->first ) <= rank ) return false;
+        icPrefetchDrop( p, worst );
+    }
+    return true;
+}
+
+/**
+* An entry whose img_src is requested. -1 if none. Call with the lock held.
+*/
+long icPrefetchNextSource( IcPrefetch* p )
+{
+    for( map<long, IcPrefetchEntry>::iterator iter = p->entries.begin(); iter != p->entries.end(); iter++ )
+    {
+        if( iter->second.want_source && iter->second.source_state == IC_PREFETCH_EMPTY ) return iter->first;
+    }
+    return -1;
+}
+
+/**
+* The most urgent file not read into the file cache yet, nor taken by a
+* reader. -1 if the read window is complete. Files found are marked as
+* recently used, so that the file cache drops files out of the window first.
+* Call with the lock held.
+*
+* @param p     The prefetcher
+* @param hints The files to be read after it, up to IC_PREFETCH_HINTS
+* @return The filelist index
+*/
+long icPrefetchNextRead( IcPrefetch* p, vector<string>* hints )
+{
+    long size = (long)p->filelist->size(), next = -1;
+    // the decode window is read in any case
+    long ahead = max( IC_PREFETCH_READ_AHEAD, p->ahead ), behind = max( IC_PREFETCH_READ_BEHIND, p->behind );
+    for( long d = 0; d <= max( ahead, behind ); d++ )
+    {
+        long candidates[2] = { p->current + d, p->current - d };
+        for( int i = 0; i < ( d == 0 ? 1 : 2 ); i++ )
+        {
+            long index = candidates[i];
+            if( index < 0 || index >= size ) continue;
+            if( index - p->current > ahead || p->current - index > behind ) continue;
+            string path = fs::realpath( (*p->filelist)[index] );
+            if( p->reading.count( path ) || icFileCacheHas( p->files, path ) ) continue;
+            if( next < 0 ) next = index;
+            else if( hints->size() < IC_PREFETCH_HINTS ) hints->push_back( path );
+            else return next;
+        }
+    }
+    return next;
+}
+
+void icPrefetchStore( IcPrefetch* p, long index, const IcPrefetchEntry& entry )
+{
+    p->entries[index] = entry;
+    p->entries[index].used = ++p->clock;
+    p->bytes += icPrefetchEntryBytes( entry );
+}
+
+void icPrefetchStoreSource( IcPrefetch* p, long index, IplImage* img_src )
+{
+    IcPrefetchEntry& entry = p->entries[index];
+    entry.img_src = img_src;
+    entry.source_state = img_src ? IC_PREFETCH_READY : IC_PREFETCH_FAILED;
+    entry.want_source = false;
+    if( img_src ) p->bytes += img_src->imageSize;
+}
+
+void icPrefetchWorker( IcPrefetch* p )
+{
+    unique_lock<mutex> lk( p->lock );
+    while( !p->quit )
+    {
+        icPrefetchEvict( p );
+        // a requested full resolution image comes before prefetching
+        long index = icPrefetchNextSource( p );
+        if( index >= 0 )
+        {
+            p->entries[index].source_state = IC_PREFETCH_LOADING;
+            string filename = (*p->filelist)[index];
+            lk.unlock();
+            IplImage* img_src = icFileCacheLoadImage( p->files, fs::realpath( filename ) );
+            lk.lock();
+            icPrefetchStoreSource( p, index, img_src );
+            p->cond.notify_all();
+            continue;
+        }
+        index = icPrefetchNext( p );
+        if( index < 0 || !icPrefetchMakeRoom( p, index ) )
+        {
+            p->cond.wait( lk );
+            continue;
+        }
+        p->entries[index].state = IC_PREFETCH_LOADING;
+        string filename = (*p->filelist)[index];
+        lk.unlock();
+        IcPrefetchEntry entry = icPrefetchDecode( filename, p->screen_size, p->files );
+        lk.lock();
+        icPrefetchStore( p, index, entry );
+        p->cond.notify_all();
+    }
+}
+
+/**
+* I/O pool thread. Reads the files around the current index into the file
+* cache, the most urgent first, and hints the files to be read after them.
+*/
+void icPrefetchReader( IcPrefetch* p )
+{
+    unique_lock<mutex> lk( p->lock );
+    while( !p->quit )
+    {
+        vector<string> hints;
+        long index = icPrefetchNextRead( p, &hints );
+        if( index < 0 )
+        {
+            p->cond.wait( lk );
+            continue;
+        }
+        string path = fs::realpath( (*p->filelist)[index] );
+        p->reading.insert( path );
+        lk.unlock();
+        for( size_t i = 0; i < hints.size(); i++ )
+            icFileCacheHint( p->files, hints[i] );
+        icFileCacheRead( p->files, path );
+        lk.lock();
+        p->reading.erase( path );
+        // the decoder may be waiting for this file
+        p->cond.notify_all();
+    }
+}
+
+/**
+* Create a prefetcher and start its background threads
+*
+* @param filelist     The files to be read. Must outlive the prefetcher.
+* @param screen_size  The screen resolution for display pyramids
+* @param [ahead = 4]  The number of next entries kept decoded
+* @param [behind = 2] The number of previous entries kept decoded
+* @param [max_bytes = 1GB] The memory ceiling of decoded entries.
+*                     The current entry is kept even beyond it.
+* @param [max_file_bytes = 2GB] The memory ceiling of the file cache
+* @return IcPrefetch*
+*/
+IcPrefetch* icCreatePrefetch( vector<string>* filelist, CvSize screen_size,
+                              int ahead = 4, int behind = 2, size_t max_bytes = (size_t)1 << 30,
+                              size_t max_file_bytes = (size_t)1 << 31 )
+{
+    IcPrefetch* p = new IcPrefetch();
+    p->filelist = filelist;
+    p->screen_size = screen_size;
+    p->ahead = max( 0, ahead );
+    p->behind = max( 0, behind );
+    p->max_bytes = max_bytes;
+    p->bytes = 0;
+    p->files = icCreateFileCache( max_file_bytes );
+    p->clock = 0;
+    p->current = 0;
+    p->pinned = -1;
+    p->hits = 0;
+    p->misses = 0;
+    p->quit = false;
+    p->worker = thread( icPrefetchWorker, p );
+    for( int i = 0; i < IC_PREFETCH_READERS; i++ )
+        p->readers.push_back( thread( icPrefetchReader, p ) );
+    return p;
+}
+
+/**
+* Stop the background threads and release all decoded images
+*/
+void icReleasePrefetch( IcPrefetch** p )
+{
+    if( *p == NULL ) return;
+    {
+        lock_guard<mutex> lk( (*p)->lock );
+        (*p)->quit = true;
+        (*p)->cond.notify_all();
+    }
+    (*p)->worker.join();
+    for( size_t i = 0; i < (*p)->readers.size(); i++ )
+        (*p)->readers[i].join();
+    while( !(*p)->entries.empty() )
+        icPrefetchDrop( *p, (*p)->entries.begin() );
+    icReleaseFileCache( &(*p)->files );
+    delete *p;
+    *p = NULL;
+}
+
+/**
+* Replace the filelist by a longer one, keeping decoded entries
+*
+* Entries are moved to the indices of their files in the new filelist.
+* Entries of files no longer listed are dropped.
+*
+* @param p        The prefetcher
+* @param filelist The new files, sorted. Must contain the file whose images
+*                 the caller holds. Swapped with the filelist of the prefetcher.
+*/
+void icPrefetchSwapList( IcPrefetch* p, vector<string>& filelist )
+{
+    unique_lock<mutex> lk( p->lock );
+    bool loading = true;
+    while( loading )
+    {
+        loading = false;
+        for( map<long, IcPrefetchEntry>::iterator iter = p->entries.begin(); iter != p->entries.end(); iter++ )
+            loading = loading || icPrefetchBusy( iter->second );
+        if( loading ) p->cond.wait( lk );
+    }
+    map<long, IcPrefetchEntry> entries;
+    long current = -1, pinned = -1;
+    while( !p->entries.empty() )
+    {
+        map<long, IcPrefetchEntry>::iterator iter = p->entries.begin();
+        const string& filename = (*p->filelist)[iter->first];
+        long index = lower_bound( filelist.begin(), filelist.end(), filename ) - filelist.begin();
+        if( index < (long)filelist.size() && filelist[index] == filename )
+        {
+            entries[index] = iter->second;
+            if( iter->first == p->current ) current = index;
+            if( iter->first == p->pinned ) pinned = index;
+            p->entries.erase( iter );
+        }
+        else icPrefetchDrop( p, iter );
+    }
+    if( current < 0 && p->current >= 0 && p->current < (long)p->filelist->size() )
+        current = lower_bound( filelist.begin(), filelist.end(), (*p->filelist)[p->current] ) - filelist.begin();
+    p->entries.swap( entries );
+    p->current = max( 0L, current );
+    p->pinned = pinned;
+    p->filelist->swap( filelist );
+    p->cond.notify_all();
+}
+
+/**
+* Get a decoded entry and move the prefetch window to it
+*
+* Blocks until the entry is decoded. The images are owned by the prefetcher
+* and stay valid until the next call. Do not release them.
+*
+* @param p            The prefetcher
+* @param index        The filelist index
+* @param img_src      The decoded image. NULL if only a reduced image is
+*                     decoded so far. See icPrefetchSource.
+* @param pyramid      The display pyramid of img_src
+* @param scale_factor The scale factor to fit screen
+* @return false if the file is not loadable. Outputs are not modified.
+*/
+bool icPrefetchGet( IcPrefetch* p, long index,
+                    IplImage** img_src, IcPyramid** pyramid, float* scale_factor )
+{
+    unique_lock<mutex> lk( p->lock );
+    p->current = index;
+    p->cond.notify_all();
+
+    map<long, IcPrefetchEntry>::iterator iter = p->entries.find( index );
+    if( iter != p->entries.end() && iter->second.state != IC_PREFETCH_LOADING )
+    {
+        p->hits++;
+    }
+    else
+    {
+        p->misses++;
+        if( iter == p->entries.end() )
+        {
+            // decode here rather than waiting for the worker to get to it
+            p->entries[index].state = IC_PREFETCH_LOADING;
+            lk.unlock();
+            IcPrefetchEntry entry = icPrefetchDecode( (*p->filelist)[index], p->screen_size, p->files );
+            lk.lock();
+            icPrefetchStore( p, index, entry );
+            p->cond.notify_all();
+        }
+        while( p->entries[index].state == IC_PREFETCH_LOADING )
+            p->cond.wait( lk );
+        iter = p->entries.find( index );
+    }
+
+    if( iter->second.state != IC_PREFETCH_READY )
+    {
+        p->current = p->pinned;
+        return false;
+    }
+    p->pinned = index;
+    iter->second.used = ++p->clock;
+    *img_src = iter->second.img_src;
+    *pyramid = iter->second.pyramid;
+    *scale_factor = iter->second.scale_factor;
+    return true;
+}
+
+/**
+* Get the tiled image of an entry got by icPrefetchGet
+*
+* @return IcTiledImage*. NULL if the entry is not a large TIFF. Owned by the prefetcher.
+*/
+IcTiledImage* icPrefetchTiled( IcPrefetch* p, long index )
+{
+    lock_guard<mutex> lk( p->lock );
+    map<long, IcPrefetchEntry>::iterator iter = p->entries.find( index );
+    return iter == p->entries.end() ? NULL : iter->second.tiled;
+}
+
+/**
+* Get the full resolution image of an entry got by icPrefetchGet
+*
+* Entries decoded at a reduced size for display are decoded again at full
+* resolution only when this is called.
+*
+* @param p     The prefetcher
+* @param index The filelist index
+* @param wait  Decode and block until it is done. Otherwise the decode is
+*              requested to the background thread and NULL is returned
+*              until it is done.
+* @return IplImage*. NULL if not decoded (yet). Owned by the prefetcher.
+*/
+IplImage* icPrefetchSource( IcPrefetch* p, long index, bool wait )
+{
+    unique_lock<mutex> lk( p->lock );
+    map<long, IcPrefetchEntry>::iterator iter = p->entries.find( index );
+    if( iter == p->entries.end() || iter->second.state != IC_PREFETCH_READY ) return NULL;
+    if( iter->second.source_state == IC_PREFETCH_EMPTY )
+    {
+        if( !wait )
+        {
+            iter->second.want_source = true;
+            p->cond.notify_all();
+            return NULL;
+        }
+        iter->second.source_state = IC_PREFETCH_LOADING;
+        string filename = (*p->filelist)[index];
+        lk.unlock();
+        IplImage* img_src = icFileCacheLoadImage( p->files, fs::realpath( filename ) );
+        lk.lock();
+        icPrefetchStoreSource( p, index, img_src );
+        p->cond.notify_all();
+    }
+    while( wait && p->entries[index].source_state == IC_PREFETCH_LOADING )
+        p->cond.wait( lk );
+    return p->entries[index].img_src;
+}
+
+#endif
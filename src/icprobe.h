@@ -0,0 +1,303 @@
+/** @file
+*
+* Image clipper image header probe
+*
+* Reads the width, height, channels and bit depth of an image from its file
+* header without decoding pixels. JPEG (SOF marker), PNG (IHDR chunk),
+* TIFF (first IFD), BMP and PNM (PBM, PGM, PPM) headers are understood.
+*
+* The MIT License
+*
+* Copyright (c) 2008, Naotoshi Seo <sonots(at)umd.edu>
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+#ifndef IC_PROBE_INCLUDED
+#define IC_PROBE_INCLUDED
+
+#include "cxcore.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+using namespace std;
+
+#define IC_PROBE_UNKNOWN 0
+#define IC_PROBE_JPEG    1
+#define IC_PROBE_PNG     2
+#define IC_PROBE_TIFF    3
+#define IC_PROBE_BMP     4
+#define IC_PROBE_PNM     5
+
+/**
+* Image properties read from a file header
+*/
+typedef struct IcImageInfo {
+    int format;                /**< IC_PROBE_JPEG, _PNG, _TIFF, _BMP or _PNM */
+    int width;
+    int height;
+    int channels;              /**< channels stored in the file. A palette counts as 3. */
+    int depth;                 /**< bits per channel */
+} IcImageInfo;
+
+inline unsigned int icProbeBE16( const unsigned char* p ) { return ( p[0] << 8 ) | p[1]; }
+inline unsigned int icProbeBE32( const unsigned char* p ) { return ( (unsigned int)p[0] << 24 ) | ( p[1] << 16 ) | ( p[2] << 8 ) | p[3]; }
+inline unsigned int icProbeLE16( const unsigned char* p ) { return p[0] | ( p[1] << 8 ); }
+inline unsigned int icProbeLE32( const unsigned char* p ) { return p[0] | ( p[1] << 8 ) | ( p[2] << 16 ) | ( (unsigned int)p[3] << 24 ); }
+
+/**
+* A file or its contents already in memory
+*/
+typedef struct IcProbeStream {
+    FILE* fp;                  /**< the file. NULL to read data. */
+    const unsigned char* data; /**< the contents */
+    size_t size;               /**< bytes of data */
+} IcProbeStream;
+
+inline bool icProbeRead( IcProbeStream* fp, long offset, unsigned char* buf, size_t size )
+{
+    if( fp->fp != NULL ) return fseek( fp->fp, offset, SEEK_SET ) == 0 && fread( buf, 1, size, fp->fp ) == size;
+    if( offset < 0 || (size_t)offset > fp->size || fp->size - (size_t)offset < size ) return false;
+    memcpy( buf, fp->data + offset, size );
+    return true;
+}
+
+bool icProbePNG( IcProbeStream* fp, IcImageInfo* info )
+{
+    // signature(8) length(4) "IHDR" width(4) height(4) bit_depth(1) color_type(1)
+    unsigned char buf[26];
+    if( !icProbeRead( fp, 0, buf, sizeof(buf) ) || memcmp( buf + 12, "IHDR", 4 ) != 0 ) return false;
+    static const int channels[7] = { 1, 0, 3, 3, 2, 0, 4 };
+    if( buf[25] > 6 || channels[buf[25]] == 0 ) return false;
+    info->format = IC_PROBE_PNG;
+    info->width = (int)icProbeBE32( buf + 16 );
+    info->height = (int)icProbeBE32( buf + 20 );
+    info->depth = buf[25] == 3 ? 8 : buf[24];
+    info->channels = channels[buf[25]];
+    return true;
+}
+
+bool icProbeJPEG( IcProbeStream* fp, IcImageInfo* info )
+{
+    unsigned char buf[8];
+    long offset = 2;
+    while( icProbeRead( fp, offset, buf, 2 ) )
+    {
+        if( buf[0] != 0xFF ) return false;
+        int marker = buf[1];
+        if( marker == 0xFF ) { offset++; continue; } // fill byte
+        offset += 2;
+        if( marker == 0x01 || ( 0xD0 <= marker && marker <= 0xD8 ) ) continue; // no length
+        if( marker == 0xD9 || marker == 0xDA ) return false; // no frame header before scan
+        if( !icProbeRead( fp, offset, buf, 2 ) ) return false;
+        unsigned int length = icProbeBE16( buf );
+        // SOF0-SOF15 except DHT, JPG and DAC
+        if( 0xC0 <= marker && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC )
+        {
+            // length(2) precision(1) height(2) width(2) components(1)
+            if( !icProbeRead( fp, offset, buf, 8 ) ) return false;
+            info->format = IC_PROBE_JPEG;
+            info->depth = buf[2];
+            info->height = (int)icProbeBE16( buf + 3 );
+            info->width = (int)icProbeBE16( buf + 5 );
+            info->channels = buf[7];
+            return info->height > 0; // 0 means defined by DNL, not supported
+        }
+        offset += length;
+    }
+    return false;
+}
+
+bool icProbeTIFF( IcProbeStream* fp, IcImageInfo* info )
+{
+    unsigned char buf[12];
+    if( !icProbeRead( fp, 0, buf, 8 ) ) return false;
+    bool le = ( buf[0] == 'I' );
+    unsigned int (*u16)( const unsigned char* ) = le ? icProbeLE16 : icProbeBE16;
+    unsigned int (*u32)( const unsigned char* ) = le ? icProbeLE32 : icProbeBE32;
+    if( u16( buf + 2 ) != 42 ) return false; // BigTIFF is not supported
+    long ifd = (long)u32( buf + 4 );
+    if( !icProbeRead( fp, ifd, buf, 2 ) ) return false;
+    unsigned int nentries = u16( buf );
+    info->format = IC_PROBE_TIFF;
+    info->width = info->height = 0;
+    info->channels = 1;
+    info->depth = 1;
+    for( unsigned int i = 0; i < nentries; i++ )
+    {
+        // tag(2) type(2) count(4) value or offset(4)
+        if( !icProbeRead( fp, ifd + 2 + 12 * i, buf, 12 ) ) return false;
+        unsigned int tag = u16( buf ), type = u16( buf + 2 ), count = u32( buf + 4 );
+        unsigned int value = ( type == 3 ) ? u16( buf + 8 ) : u32( buf + 8 ); // SHORT or LONG
+        if( tag == 256 ) info->width = (int)value;
+        else if( tag == 257 ) info->height = (int)value;
+        else if( tag == 277 ) info->channels = (int)value;
+        else if( tag == 258 )
+        {
+            // more than two SHORTs do not fit in the entry
+            if( count > 2 && !icProbeRead( fp, (long)u32( buf + 8 ), buf + 8, 2 ) ) return false;
+            info->depth = (int)u16( buf + 8 );
+        }
+    }
+    return info->width > 0 && info->height > 0;
+}
+
+bool icProbeBMP( IcProbeStream* fp, IcImageInfo* info )
+{
+    // file header(14) header size(4) width height planes(2) bit_count(2)
+    unsigned char buf[30];
+    if( !icProbeRead( fp, 0, buf, 26 ) ) return false;
+    unsigned int size = icProbeLE32( buf + 14 );
+    int bit_count;
+    if( size == 12 ) // OS/2 BITMAPCOREHEADER
+    {
+        info->width = (int)icProbeLE16( buf + 18 );
+        info->height = (int)icProbeLE16( buf + 20 );
+        bit_count = (int)icProbeLE16( buf + 24 );
+    }
+    else
+    {
+        if( size < 16 || !icProbeRead( fp, 0, buf, 30 ) ) return false;
+        info->width = (int)icProbeLE32( buf + 18 );
+        info->height = abs( (int)icProbeLE32( buf + 22 ) ); // negative for top-down
+        bit_count = (int)icProbeLE16( buf + 28 );
+    }
+    info->format = IC_PROBE_BMP;
+    info->channels = bit_count == 32 ? 4 : 3;
+    info->depth = 8;
+    return info->width > 0 && info->height > 0;
+}
+
+/**
+* Parse a PNM header in memory
+*
+* @param buf    The beginning of the file
+* @param size   The bytes in buf
+* @param info   The image properties
+* @param offset The offset of the pixel data
+* @return false if not a PNM header
+*/
+bool icParsePNM( const unsigned char* buf, size_t size, IcImageInfo* info, size_t* offset )
+{
+    if( size < 3 || buf[0] != 'P' || buf[1] < '1' || buf[1] > '6' ) return false;
+    int type = buf[1] - '0';
+    int values[3] = { 0, 0, 1 }; // width height maxval. PBM has no maxval.
+    int nvalues = ( type == 1 || type == 4 ) ? 2 : 3;
+    size_t pos = 2;
+    for( int i = 0; i < nvalues; i++ )
+    {
+        while( pos < size && ( isspace( buf[pos] ) || buf[pos] == '#' ) )
+        {
+            if( buf[pos] == '#' ) { while( pos < size && buf[pos] != '\n' ) pos++; }
+            else pos++;
+        }
+        if( pos >= size || !isdigit( buf[pos] ) ) return false;
+        for( values[i] = 0; pos < size && isdigit( buf[pos] ); pos++ )
+        {
+            if( values[i] >= ( 1 << 24 ) ) return false;
+            values[i] = values[i] * 10 + ( buf[pos] - '0' );
+        }
+    }
+    // a single white space precedes the pixel data
+    if( pos >= size || !isspace( buf[pos] ) ) return false;
+    *offset = pos + 1;
+    info->format = IC_PROBE_PNM;
+    info->width = values[0];
+    info->height = values[1];
+    info->channels = ( type == 3 || type == 6 ) ? 3 : 1;
+    info->depth = ( type == 1 || type == 4 ) ? 1 : ( values[2] < 256 ? 8 : 16 );
+    return info->width > 0 && info->height > 0 && values[2] > 0 && values[2] < 65536;
+}
+
+bool icProbePNM( IcProbeStream* fp, IcImageInfo* info )
+{
+    unsigned char buf[4096];
+    size_t size = sizeof(buf), offset;
+    if( fp->fp == NULL ) return icParsePNM( fp->data, fp->size, info, &offset );
+    if( fseek( fp->fp, 0, SEEK_SET ) != 0 ) return false;
+    size = fread( buf, 1, size, fp->fp );
+    return icParsePNM( buf, size, info, &offset );
+}
+
+/**
+* Read image properties from a file header in a stream
+*
+* @see icProbeImage
+*/
+bool icProbeStream( IcProbeStream* fp, IcImageInfo* info )
+{
+    unsigned char magic[4];
+    bool ok = false;
+    if( icProbeRead( fp, 0, magic, 4 ) )
+    {
+        if( magic[0] == 0xFF && magic[1] == 0xD8 ) ok = icProbeJPEG( fp, info );
+        else if( memcmp( magic, "\x89PNG", 4 ) == 0 ) ok = icProbePNG( fp, info );
+        else if( memcmp( magic, "II", 2 ) == 0 || memcmp( magic, "MM", 2 ) == 0 ) ok = icProbeTIFF( fp, info );
+        else if( memcmp( magic, "BM", 2 ) == 0 ) ok = icProbeBMP( fp, info );
+        else if( magic[0] == 'P' && '1' <= magic[1] && magic[1] <= '6' ) ok = icProbePNM( fp, info );
+    }
+    if( !ok ) info->format = IC_PROBE_UNKNOWN;
+    return ok;
+}
+
+/**
+* Read image properties from the file header
+*
+* The file type is determined by its content, not by its extension.
+*
+* @param path The image filename
+* @param info The image properties
+* @return false if the file is not readable or the format is not known
+*/
+bool icProbeImage( const string& path, IcImageInfo* info )
+{
+    IcProbeStream stream = { fopen( path.c_str(), "rb" ), NULL, 0 };
+    if( stream.fp == NULL ) return false;
+    bool ok = icProbeStream( &stream, info );
+    fclose( stream.fp );
+    return ok;
+}
+
+/**
+* Read image properties from the contents of a file in memory
+*
+* @param data The file contents
+* @param size The bytes of data
+* @param info The image properties
+* @return false if the format is not known
+*/
+bool icProbeMemory( const unsigned char* data, size_t size, IcImageInfo* info )
+{
+    IcProbeStream stream = { NULL, data, size };
+    return icProbeStream( &stream, info );
+}
+
+/**
+* The image size from the file header. 0x0 if not known.
+*/
+inline CvSize icProbeSize( const string& path )
+{
+    IcImageInfo info;
+    if( !icProbeImage( path, &info ) ) return cvSize( 0, 0 );
+    return cvSize( info.width, info.height );
+}
+
+#endif
@@ -0,0 +1,231 @@
+/** @file
+*
+* Image clipper background save queue
+*
+* Crops are encoded and written by a background thread through a bounded
+* queue. Files are written to a temporary name and renamed, so that a crash
+* never leaves a half-written image behind.
+*
+* The MIT License
+*
+* Copyright (c) 2008, Naotoshi Seo <sonots(at)umd.edu>
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+#ifndef IC_SAVEQUEUE_INCLUDED
+#define IC_SAVEQUEUE_INCLUDED
+
+#include "cv.h"
+#include "cxcore.h"
+#include "highgui.h"
+#include <stdio.h>
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include "filesystem.h"
+#include "icdisplay.h"
+using namespace std;
+
+/**
+* Whether the image type of a filename stores a depth
+*
+* 16 bits are stored by PNG, TIFF, PNM and JPEG 2000, float by OpenEXR
+* and Radiance HDR. Every type stores 8 bits.
+*/
+bool icImageTypeStoresDepth( const string& path, int depth )
+{
+    static const char* types16u[] = { "png", "tif", "tiff", "pgm", "ppm", "pnm", "pxm", "jp2" };
+    static const char* types32f[] = { "exr", "hdr", "pic" };
+    static const vector<string> imtypes16u( types16u, types16u + 8 );
+    static const vector<string> imtypes32f( types32f, types32f + 3 );
+    if( depth == IPL_DEPTH_8U ) return true;
+    if( depth == IPL_DEPTH_16U ) return fs::match_extensions( path, imtypes16u );
+    if( depth == IPL_DEPTH_32F ) return fs::match_extensions( path, imtypes32f );
+    return false;
+}
+
+/**
+* Save an image through a temporary file and rename it
+*
+* The image type is determined by the filename extension as cvSaveImage.
+* The depth of the image is kept if the type stores it, otherwise the
+* image is scaled into 8 bits by icConvertTo8U instead of being saturated.
+* The file and then the rename are synced to the disk, so that a crash
+* leaves either no file or the whole file.
+*
+* @param path The output filename
+* @param img  The image
+* @return false if encoding, writing or syncing failed. No temporary file is left then.
+*/
+bool icSaveImageAtomic( const string& path, const IplImage* img )
+{
+    IplImage* converted = icImageTypeStoresDepth( path, img->depth ) ? NULL : icConvertTo8U( img );
+    CvMat* buf = cvEncodeImage( ( "." + fs::extension( path ) ).c_str(), converted ? converted : img );
+    cvReleaseImage( &converted );
+    if( buf == NULL ) return false;
+    string tmp_path = path + ".tmp";
+    FILE* fp = fopen( tmp_path.c_str(), "wb" );
+    bool ok = ( fp != NULL );
+    if( ok )
+    {
+        size_t size = (size_t)buf->rows * buf->cols;
+        ok = ( fwrite( buf->data.ptr, 1, size, fp ) == size ) && fs::sync( fp );
+        ok = ( fclose( fp ) == 0 ) && ok;
+    }
+    cvReleaseMat( &buf );
+    try
+    {
+        if( ok ) fs::rename( tmp_path, path );
+        if( ok ) return fs::sync_directory( fs::dirname( path ) );
+    }
+    catch( ... )
+    {
+        ok = false;
+    }
+    if( !ok ) fs::remove( tmp_path );
+    return ok;
+}
+
+/**
+* A pending crop
+*/
+typedef struct IcSaveJob {
+    string path;               /**< output filename */
+    IplImage* img;             /**< crop, owned by the queue */
+} IcSaveJob;
+
+/**
+* Save queue state. Use icCreateSaveQueue and icReleaseSaveQueue.
+*/
+typedef struct IcSaveQueue {
+    deque<IcSaveJob> jobs;     /**< crops waiting to be written */
+    size_t capacity;           /**< producers block beyond this */
+    bool busy;                 /**< a crop is being written */
+    bool quit;
+    long written;              /**< number of crops written */
+    long failed;               /**< number of crops failed */
+    mutex lock;
+    condition_variable cond;
+    thread worker;
+} IcSaveQueue;
+
+void icSaveQueueWorker( IcSaveQueue* q )
+{
+    unique_lock<mutex> lk( q->lock );
+    while( true )
+    {
+        while( q->jobs.empty() && !q->quit ) q->cond.wait( lk );
+        if( q->jobs.empty() ) break;
+        IcSaveJob job = q->jobs.front();
+        q->jobs.pop_front();
+        q->busy = true;
+        q->cond.notify_all();
+        lk.unlock();
+
+        bool ok;
+        try
+        {
+            fs::create_directories( fs::dirname( job.path ) );
+            ok = icSaveImageAtomic( job.path, job.img );
+        }
+        catch( ... )
+        {
+            ok = false;
+        }
+        if( !ok ) cerr << "Failed to write " << job.path << endl;
+        cvReleaseImage( &job.img );
+
+        lk.lock();
+        q->busy = false;
+        if( ok ) q->written++;
+        else q->failed++;
+        q->cond.notify_all();
+    }
+}
+
+/**
+* Create a save queue and start its background thread
+*
+* @param [capacity = 64] The number of crops which may wait to be written
+* @return IcSaveQueue*
+*/
+IcSaveQueue* icCreateSaveQueue( size_t capacity = 64 )
+{
+    IcSaveQueue* q = new IcSaveQueue();
+    q->capacity = max( (size_t)1, capacity );
+    q->busy = false;
+    q->quit = false;
+    q->written = 0;
+    q->failed = 0;
+    q->worker = thread( icSaveQueueWorker, q );
+    return q;
+}
+
+/**
+* Queue a crop to be written. Blocks while the queue is full.
+*
+* @param q    The save queue
+* @param path The output filename. Its directory is created if necessary.
+* @param img  The crop. The queue takes ownership and releases it.
+*/
+void icSaveQueuePush( IcSaveQueue* q, const string& path, IplImage* img )
+{
+    unique_lock<mutex> lk( q->lock );
+    while( q->jobs.size() >= q->capacity ) q->cond.wait( lk );
+    IcSaveJob job = { path, img };
+    q->jobs.push_back( job );
+    q->cond.notify_all();
+}
+
+/**
+* Write all queued crops with a progress report and stop the background thread
+*/
+void icReleaseSaveQueue( IcSaveQueue** q )
+{
+    if( *q == NULL ) return;
+    {
+        unique_lock<mutex> lk( (*q)->lock );
+        size_t reported = 0;
+        while( !(*q)->jobs.empty() || (*q)->busy )
+        {
+            size_t pending = (*q)->jobs.size() + ( (*q)->busy ? 1 : 0 );
+            if( pending != reported )
+            {
+                cerr << "Now saving..... " << pending << " crops remaining" << endl;
+                reported = pending;
+            }
+            (*q)->cond.wait( lk );
+        }
+        (*q)->quit = true;
+        (*q)->cond.notify_all();
+    }
+    (*q)->worker.join();
+    cerr << "Saved " << (*q)->written << " crops";
+    if( (*q)->failed > 0 ) cerr << ", " << (*q)->failed << " failed";
+    cerr << "." << endl;
+    delete *q;
+    *q = NULL;
+}
+
+#endif
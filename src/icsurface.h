@@ -0,0 +1,224 @@
+/** @file
+*
+* Image clipper display surface
+*
+* A persistent copy of the display image on which the rectangle or watershed
+* overlay is drawn. Redrawing restores only the region the previous overlay
+* touched instead of cloning the whole image on every mouse move.
+*
+* The MIT License
+*
+* Copyright (c) 2008, Naotoshi Seo <sonots(at)umd.edu>
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+#ifndef IC_SURFACE_INCLUDED
+#define IC_SURFACE_INCLUDED
+
+#include "cv.h"
+#include "cxcore.h"
+#include "highgui.h"
+#define _USE_MATH_DEFINES
+#include <math.h>
+#include <algorithm>
+#include "cvdrawwatershed.h"
+#include "opencvx/cvrect32f.h"
+#include "opencvx/cvcropimageroi.h"
+#include "opencvx/cvdrawrectangle.h"
+using namespace std;
+
+/**
+* Display surface state. Use icCreateSurface and icReleaseSurface.
+*/
+typedef struct IcSurface {
+    const IplImage* base;      /**< image under the overlay, not owned */
+    IplImage* canvas;          /**< base with the overlay drawn */
+    CvRect dirty;              /**< canvas region the overlay has drawn on */
+} IcSurface;
+
+IcSurface* icCreateSurface()
+{
+    IcSurface* surface = new IcSurface();
+    surface->base = NULL;
+    surface->canvas = NULL;
+    surface->dirty = cvRect( 0, 0, 0, 0 );
+    return surface;
+}
+
+void icReleaseSurface( IcSurface** surface )
+{
+    if( *surface == NULL ) return;
+    cvReleaseImage( &(*surface)->canvas );
+    delete *surface;
+    *surface = NULL;
+}
+
+/**
+* Forget the base image. Call when the pixels of the base image changed.
+*/
+inline void icSurfaceInvalidate( IcSurface* surface )
+{
+    surface->base = NULL;
+}
+
+/**
+* Intersection of rectangles. width or height is 0 if empty.
+*/
+inline CvRect icIntersectRect( CvRect a, CvRect b )
+{
+    int x1 = max( a.x, b.x ), y1 = max( a.y, b.y );
+    int x2 = min( a.x + a.width, b.x + b.width ), y2 = min( a.y + a.height, b.y + b.height );
+    return cvRect( x1, y1, max( 0, x2 - x1 ), max( 0, y2 - y1 ) );
+}
+
+/**
+* Bounding box of a rotated and sheared rectangle drawn by cvDrawRectangle
+*
+* @param rect32f The rectangle
+* @param shear   The shear deformation
+* @param pad     Pixels added around for line thickness and rounding
+* @return CvRect
+*/
+CvRect icRectangleBoundingRect( CvRect32f rect32f, CvPoint2D32f shear, int pad )
+{
+    // the affine of cvCreateAffine: [ a b tx; c d ty ] = [ R * [w shx; shy h] T ]
+    double c = cos( -M_PI / 180 * rect32f.angle );
+    double s = sin( -M_PI / 180 * rect32f.angle );
+    double a00 = c * rect32f.width - s * shear.y, a01 = c * shear.x - s * rect32f.height;
+    double a10 = s * rect32f.width + c * shear.y, a11 = s * shear.x + c * rect32f.height;
+    double minx = rect32f.x, maxx = rect32f.x, miny = rect32f.y, maxy = rect32f.y;
+    for( int v = 0; v <= 1; v++ )
+    {
+        for( int u = 0; u <= 1; u++ )
+        {
+            double x = a00 * u + a01 * v + rect32f.x;
+            double y = a10 * u + a11 * v + rect32f.y;
+            minx = min( minx, x ); maxx = max( maxx, x );
+            miny = min( miny, y ); maxy = max( maxy, y );
+        }
+    }
+    return cvRect( cvFloor( minx ) - pad, cvFloor( miny ) - pad,
+                   cvCeil( maxx ) - cvFloor( minx ) + 2 * pad + 1,
+                   cvCeil( maxy ) - cvFloor( miny ) + 2 * pad + 1 );
+}
+
+/**
+* Source pixels a crop samples, clipped to the image
+*
+* Regions decoded under the clipped box end at the true image border, which
+* the interpolation replicates, instead of at black padding that would be
+* blended into the edge pixels of the crop.
+*
+* @param rect32f The rectangle
+* @param shear   The shear deformation
+* @param interpolation The sampling. See cvCropImageROI.
+* @param size    The image size
+* @return CvRect. width or height is 0 if the crop is outside of the image.
+*/
+CvRect icCropSourceRect( CvRect32f rect32f, CvPoint2D32f shear, int interpolation, CvSize size )
+{
+    return icIntersectRect( icRectangleBoundingRect( rect32f, shear, 1 + ICV_INTER_REACH( interpolation ) ),
+                            cvRect( 0, 0, size.width, size.height ) );
+}
+
+/**
+* Bring the canvas back to the base image
+*
+* Copies the whole image only when the base changed. Otherwise only the
+* region the previous overlay drew on is restored.
+*/
+void icSurfaceRestore( IcSurface* surface, const IplImage* img )
+{
+    if( surface->canvas == NULL ||
+        surface->canvas->width != img->width || surface->canvas->height != img->height ||
+        surface->canvas->depth != img->depth || surface->canvas->nChannels != img->nChannels )
+    {
+        cvReleaseImage( &surface->canvas );
+        surface->canvas = cvCreateImage( cvGetSize( img ), img->depth, img->nChannels );
+        surface->base = NULL;
+    }
+    if( surface->base != img )
+    {
+        cvCopy( img, surface->canvas );
+        surface->base = img;
+    }
+    else if( surface->dirty.width > 0 && surface->dirty.height > 0 )
+    {
+        CvMat src, dst;
+        cvGetSubRect( img, &src, surface->dirty );
+        cvGetSubRect( surface->canvas, &dst, surface->dirty );
+        cvCopy( &src, &dst );
+    }
+    surface->dirty = cvRect( 0, 0, 0, 0 );
+}
+
+/**
+* Show Image and Rectangle on a surface
+*
+* Same as cvShowImageAndRectangle without cloning the image.
+*
+* @param surface The display surface
+* @param w_name  Window name
+* @param img     Image to be shown
+* @see cvShowImageAndRectangle for the other parameters
+*/
+void icSurfaceShowRectangle( IcSurface* surface, const char* w_name, const IplImage* img,
+                             CvRect32f rect32f, CvPoint2D32f shear,
+                             CvScalar color = CV_RGB(255, 255, 0), int thickness = 1 )
+{
+    icSurfaceRestore( surface, img );
+    CvRect rect = cvRectFromRect32f( rect32f );
+    if( rect.width > 0 && rect.height > 0 )
+    {
+        cvDrawRectangle( surface->canvas, rect32f, shear, color, thickness );
+        surface->dirty = icIntersectRect( icRectangleBoundingRect( rect32f, shear, thickness + 1 ),
+                                          cvRect( 0, 0, img->width, img->height ) );
+    }
+    cvShowImage( w_name, surface->canvas );
+}
+
+/**
+* Show Image and Watershed on a surface
+*
+* Same as cvShowImageAndWatershed without cloning the image.
+*
+* @param surface The display surface
+* @param w_name  Window name
+* @param img     Image to be shown
+* @param circle  x,y as center, width as radius of the watershed marker
+* @return The rectangle surrounding the watershed
+*/
+CvRect icSurfaceShowWatershed( IcSurface* surface, const char* w_name, const IplImage* img, const CvRect &circle )
+{
+    icSurfaceRestore( surface, img );
+    CvRect rect = cvDrawWatershed( surface->canvas, circle );
+    cvRectangle( surface->canvas, cvPoint( rect.x, rect.y ), cvPoint( rect.x + rect.width, rect.y + rect.height ), CV_RGB(255, 255, 0), 1 );
+    // watershed lines stay within the ambiguous region of 3 * radius
+    int reach = 3 * abs( circle.width ) + 2;
+    CvRect dirty = cvRect( circle.x - reach, circle.y - reach, 2 * reach + 1, 2 * reach + 1 );
+    int x1 = min( dirty.x, rect.x - 1 ), y1 = min( dirty.y, rect.y - 1 );
+    int x2 = max( dirty.x + dirty.width, rect.x + rect.width + 2 );
+    int y2 = max( dirty.y + dirty.height, rect.y + rect.height + 2 );
+    surface->dirty = icIntersectRect( cvRect( x1, y1, x2 - x1, y2 - y1 ), cvRect( 0, 0, img->width, img->height ) );
+    cvShowImage( w_name, surface->canvas );
+    return rect;
+}
+
+#endif
@@ -0,0 +1,337 @@
+/** @file
+*
+* Image clipper tiled image source with libtiff (HAVE_TIFF)
+*
+* Large TIFF rasters are read tile by tile (or strip by strip) instead of
+* as a whole. Only the tiles under the region being shown or cropped are
+* decoded, and they are kept in a tile cache bounded by bytes. Reduced
+* resolution images stored in the file (FILETYPE_REDUCEDIMAGE directories)
+* are used for zoomed out views.
+*
+* The MIT License
+*
+* Copyright (c) 2008, Naotoshi Seo <sonots(at)umd.edu>
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+#ifndef IC_TILED_INCLUDED
+#define IC_TILED_INCLUDED
+
+#include "cv.h"
+#include "cxcore.h"
+#include "highgui.h"
+#include <algorithm>
+#include <iostream>
+#include <list>
+#include <map>
+#include <mutex>
+#include <string>
+#ifdef HAVE_TIFF
+#include <tiffio.h>
+#endif
+#include "opencvx/cvrect32f.h"
+#include "opencvx/cvcropimageroi.h"
+#include "icsurface.h"
+using namespace std;
+
+#define IC_TILED_MAX_LEVELS 16
+// images of this many pixels or more are read by tiles
+#define IC_TILED_MIN_PIXELS ( 1 << 26 )
+// a strip larger than this is not worth reading as a tile
+#define IC_TILED_MAX_TILE_BYTES ( (size_t)64 << 20 )
+
+/**
+* A resolution stored in the file
+*/
+typedef struct IcTiledLevel {
+    int dir;                   /**< TIFF directory */
+    CvSize size;               /**< image size */
+    CvSize tile;               /**< tile size. Strips are tiles as wide as the image. */
+    bool tiled;                /**< organized in tiles, not in strips */
+} IcTiledLevel;
+
+/**
+* Tiled image source. Use icOpenTiledImage and icReleaseTiledImage.
+*/
+typedef struct IcTiledImage {
+#ifdef HAVE_TIFF
+    TIFF* tif;
+#else
+    void* tif;
+#endif
+    int dir;                                    /**< current TIFF directory */
+    CvSize size;                                /**< full resolution size */
+    int nlevels;                                /**< number of levels */
+    IcTiledLevel levels[IC_TILED_MAX_LEVELS];   /**< levels[0] is the full resolution, then coarser */
+    map<unsigned long long, pair<IplImage*, list<unsigned long long>::iterator> > tiles;
+    list<unsigned long long> lru;               /**< tile keys, the most recently used first */
+    size_t bytes;                               /**< memory held by cached tiles */
+    size_t max_bytes;                           /**< memory ceiling of cached tiles */
+    mutex lock;
+} IcTiledImage;
+
+#ifdef HAVE_TIFF
+bool icTiledReadLevel( TIFF* tif, int dir, IcTiledLevel* level )
+{
+    uint32 width = 0, height = 0;
+    if( !TIFFGetField( tif, TIFFTAG_IMAGEWIDTH, &width ) || !TIFFGetField( tif, TIFFTAG_IMAGELENGTH, &height ) )
+        return false;
+    level->dir = dir;
+    level->size = cvSize( (int)width, (int)height );
+    level->tiled = TIFFIsTiled( tif ) != 0;
+    if( level->tiled )
+    {
+        uint32 tw = 0, th = 0;
+        TIFFGetField( tif, TIFFTAG_TILEWIDTH, &tw );
+        TIFFGetField( tif, TIFFTAG_TILELENGTH, &th );
+        level->tile = cvSize( (int)tw, (int)th );
+    }
+    else
+    {
+        uint32 rows = 0;
+        TIFFGetFieldDefaulted( tif, TIFFTAG_ROWSPERSTRIP, &rows );
+        level->tile = cvSize( (int)width, (int)min( rows, height ) );
+    }
+    return level->tile.width > 0 && level->tile.height > 0 &&
+        (size_t)level->tile.width * level->tile.height * 4 <= IC_TILED_MAX_TILE_BYTES;
+}
+
+inline bool icTiledLevelCoarser( const IcTiledLevel& a, const IcTiledLevel& b )
+{
+    return a.size.width > b.size.width;
+}
+#endif
+
+/**
+* Open an image to be read by tiles
+*
+* @param path  The TIFF filename
+* @param [max_bytes = 256MB] The memory ceiling of cached tiles
+* @return IcTiledImage*. NULL if not a TIFF readable by tiles or strips of
+*         moderate size, or no libtiff.
+*/
+IcTiledImage* icOpenTiledImage( const string& path, size_t max_bytes = (size_t)256 << 20 )
+{
+#ifdef HAVE_TIFF
+    TIFF* tif = TIFFOpen( path.c_str(), "r" );
+    if( tif == NULL ) return NULL;
+    IcTiledImage* t = new IcTiledImage();
+    t->tif = tif;
+    t->bytes = 0;
+    t->max_bytes = max_bytes;
+    t->nlevels = 0;
+    if( !icTiledReadLevel( tif, 0, &t->levels[0] ) )
+    {
+        TIFFClose( tif );
+        delete t;
+        return NULL;
+    }
+    t->size = t->levels[0].size;
+    t->nlevels = 1;
+    for( int dir = 1; t->nlevels < IC_TILED_MAX_LEVELS && TIFFReadDirectory( tif ); dir++ )
+    {
+        uint32 subfiletype = 0;
+        TIFFGetFieldDefaulted( tif, TIFFTAG_SUBFILETYPE, &subfiletype );
+        if( !( subfiletype & FILETYPE_REDUCEDIMAGE ) ) continue;
+        IcTiledLevel level;
+        if( !icTiledReadLevel( tif, dir, &level ) ) continue;
+        if( level.size.width >= t->size.width || level.size.height >= t->size.height ) continue;
+        t->levels[t->nlevels++] = level;
+    }
+    sort( t->levels + 1, t->levels + t->nlevels, icTiledLevelCoarser );
+    TIFFSetDirectory( tif, 0 );
+    t->dir = 0;
+    return t;
+#else
+    return NULL;
+#endif
+}
+
+void icReleaseTiledImage( IcTiledImage** t )
+{
+    if( *t == NULL ) return;
+    for( map<unsigned long long, pair<IplImage*, list<unsigned long long>::iterator> >::iterator iter = (*t)->tiles.begin();
+         iter != (*t)->tiles.end(); iter++ )
+        cvReleaseImage( &iter->second.first );
+#ifdef HAVE_TIFF
+    TIFFClose( (*t)->tif );
+#endif
+    delete *t;
+    *t = NULL;
+}
+
+/**
+* Decode a tile into an 8U 3 channels BGR image. Call with the lock held.
+*/
+IplImage* icTiledDecodeTile( IcTiledImage* t, int level, int tx, int ty )
+{
+    const IcTiledLevel& lv = t->levels[level];
+    int x = tx * lv.tile.width, y = ty * lv.tile.height;
+    int w = min( lv.tile.width, lv.size.width - x ), h = min( lv.tile.height, lv.size.height - y );
+    IplImage* tile = cvCreateImage( cvSize( w, h ), IPL_DEPTH_8U, 3 );
+    cvZero( tile );
+#ifdef HAVE_TIFF
+    if( t->dir != lv.dir )
+    {
+        TIFFSetDirectory( t->tif, (tdir_t)lv.dir );
+        t->dir = lv.dir;
+    }
+    uint32* raster = new uint32[(size_t)lv.tile.width * lv.tile.height];
+    int ok = lv.tiled ? TIFFReadRGBATile( t->tif, x, y, raster ) : TIFFReadRGBAStrip( t->tif, y, raster );
+    if( ok )
+    {
+        for( int k = 0; k < h; k++ )
+        {
+            // rasters are bottom-up. A partial tile is placed as a full one, a partial strip is not.
+            const uint32* src = raster + (size_t)( ( lv.tiled ? lv.tile.height : h ) - 1 - k ) * lv.tile.width;
+            unsigned char* dst = (unsigned char*)tile->imageData + (size_t)k * tile->widthStep;
+            for( int i = 0; i < w; i++, dst += 3 )
+            {
+                dst[0] = (unsigned char)TIFFGetB( src[i] );
+                dst[1] = (unsigned char)TIFFGetG( src[i] );
+                dst[2] = (unsigned char)TIFFGetR( src[i] );
+            }
+        }
+    }
+    else
+    {
+        cerr << "The tile at (" << x << "," << y << ") is not readable." << endl;
+    }
+    delete[] raster;
+#endif
+    return tile;
+}
+
+/**
+* Get a tile from the cache or decode it. Call with the lock held.
+*
+* The tile stays valid until the next call.
+*/
+IplImage* icTiledTile( IcTiledImage* t, int level, int tx, int ty )
+{
+    unsigned long long key = ( (unsigned long long)level << 56 ) | ( (unsigned long long)ty << 28 ) | (unsigned long long)tx;
+    map<unsigned long long, pair<IplImage*, list<unsigned long long>::iterator> >::iterator iter = t->tiles.find( key );
+    if( iter != t->tiles.end() )
+    {
+        t->lru.splice( t->lru.begin(), t->lru, iter->second.second );
+        return iter->second.first;
+    }
+    IplImage* tile = icTiledDecodeTile( t, level, tx, ty );
+    while( !t->lru.empty() && t->bytes + tile->imageSize > t->max_bytes )
+    {
+        iter = t->tiles.find( t->lru.back() );
+        t->bytes -= iter->second.first->imageSize;
+        cvReleaseImage( &iter->second.first );
+        t->tiles.erase( iter );
+        t->lru.pop_back();
+    }
+    t->lru.push_front( key );
+    t->tiles[key] = make_pair( tile, t->lru.begin() );
+    t->bytes += tile->imageSize;
+    return tile;
+}
+
+/**
+* Render a region of the image at a scale
+*
+* Reads the coarsest level at least as fine as the scale and resamples each
+* tile under the region into its place, so that the cost follows the output
+* and the tiles, not the whole image. Outside of the image is black.
+*
+* @param t      The tiled image
+* @param view   The region in display coordinates, i.e., full resolution
+*               coordinates times scale
+* @param scale  The scale factor relative to the full resolution
+* @return 8U 3 channels BGR IplImage* of the view size. Do not forget cvReleaseImage.
+*/
+IplImage* icTiledRender( IcTiledImage* t, CvRect view, float scale )
+{
+    CvSize size = cvSize( max( 1, view.width ), max( 1, view.height ) );
+    IplImage* dst = cvCreateImage( size, IPL_DEPTH_8U, 3 );
+    cvZero( dst );
+    lock_guard<mutex> lk( t->lock );
+    int level = 0;
+    while( level + 1 < t->nlevels &&
+           t->levels[level + 1].size.width >= t->size.width * scale &&
+           t->levels[level + 1].size.height >= t->size.height * scale )
+        level++;
+    const IcTiledLevel& lv = t->levels[level];
+    // level pixels per display pixel
+    double kx = (double)lv.size.width / t->size.width / scale, ky = (double)lv.size.height / t->size.height / scale;
+    // the view in level coordinates
+    CvRect lr = icIntersectRect( cvRect( cvFloor( view.x * kx ), cvFloor( view.y * ky ),
+                                         cvCeil( ( view.x + view.width ) * kx ) - cvFloor( view.x * kx ),
+                                         cvCeil( ( view.y + view.height ) * ky ) - cvFloor( view.y * ky ) ),
+                                 cvRect( 0, 0, lv.size.width, lv.size.height ) );
+    if( lr.width == 0 || lr.height == 0 ) return dst;
+    for( int ty = lr.y / lv.tile.height; ty <= ( lr.y + lr.height - 1 ) / lv.tile.height; ty++ )
+    {
+        for( int tx = lr.x / lv.tile.width; tx <= ( lr.x + lr.width - 1 ) / lv.tile.width; tx++ )
+        {
+            IplImage* tile = icTiledTile( t, level, tx, ty );
+            CvRect tr = icIntersectRect( cvRect( tx * lv.tile.width, ty * lv.tile.height, tile->width, tile->height ), lr );
+            // adjacent tiles share the rounded boundary so that no seam is left
+            int x0 = max( 0, cvRound( tr.x / kx - view.x ) );
+            int x1 = min( size.width, cvRound( ( tr.x + tr.width ) / kx - view.x ) );
+            int y0 = max( 0, cvRound( tr.y / ky - view.y ) );
+            int y1 = min( size.height, cvRound( ( tr.y + tr.height ) / ky - view.y ) );
+            if( x1 <= x0 || y1 <= y0 ) continue;
+            CvMat src, out;
+            cvGetSubRect( tile, &src, cvRect( tr.x - tx * lv.tile.width, tr.y - ty * lv.tile.height, tr.width, tr.height ) );
+            cvGetSubRect( dst, &out, cvRect( x0, y0, x1 - x0, y1 - y0 ) );
+            if( x1 - x0 == tr.width && y1 - y0 == tr.height ) cvCopy( &src, &out );
+            else cvResize( &src, &out, x1 - x0 < tr.width ? CV_INTER_AREA : CV_INTER_LINEAR );
+        }
+    }
+    return dst;
+}
+
+/**
+* Crop a rotated and sheared rectangle from the full resolution
+*
+* Only the tiles under the bounding box of the rectangle are read.
+*
+* @param t       The tiled image
+* @param rect32f The rectangle in full resolution coordinates
+* @param shear   The shear deformation
+* @param [interpolation = CV_INTER_NN] The sampling. See cvCropImageROI.
+* @return IplImage* of the rectangle size. Do not forget cvReleaseImage.
+* @see cvCropImageROI
+*/
+IplImage* icTiledCrop( IcTiledImage* t, CvRect32f rect32f, CvPoint2D32f shear,
+                       int interpolation = CV_INTER_NN )
+{
+    CvRect rect = cvRectFromRect32f( rect32f );
+    CvRect bound = icCropSourceRect( rect32f, shear, interpolation, t->size );
+    IplImage* crop = cvCreateImage( cvSize( rect.width, rect.height ), IPL_DEPTH_8U, 3 );
+    if( bound.width == 0 || bound.height == 0 )
+    {
+        cvZero( crop );
+        return crop;
+    }
+    IplImage* region = icTiledRender( t, bound, 1.0f );
+    rect32f.x -= bound.x;
+    rect32f.y -= bound.y;
+    cvCropImageROI( region, crop, rect32f, shear, interpolation );
+    cvReleaseImage( &region );
+    return crop;
+}
+
+#endif
@@ -0,0 +1,230 @@
+/** @file
+*
+* Image clipper video index
+*
+* Keyframe positions and the exact frame count of a video, cached in a
+* sidecar file next to the video so that random seeks start from the nearest
+* keyframe and decode the minimum number of frames.
+* The index is built with FFmpeg (HAVE_FFMPEG). Without it, seeks fall back
+* to CV_CAP_PROP_POS_FRAMES.
+*
+* The MIT License
+*
+* Copyright (c) 2008, Naotoshi Seo <sonots(at)umd.edu>
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+#ifndef IC_VIDEOINDEX_INCLUDED
+#define IC_VIDEOINDEX_INCLUDED
+
+#include "cv.h"
+#include "cxcore.h"
+#include "highgui.h"
+#include <algorithm>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "filesystem.h"
+#ifdef HAVE_FFMPEG
+extern "C" {
+#include <libavformat/avformat.h>
+}
+#endif
+using namespace std;
+
+#define IC_VIDEOINDEX_MAGIC "imageclipper-videoindex 1"
+
+/**
+* Video index
+*/
+typedef struct IcVideoIndex {
+    string path;               /**< video filename */
+    uintmax_t size;            /**< video file size when indexed */
+    time_t mtime;              /**< video modification time when indexed */
+    int nframes;               /**< exact number of frames */
+    vector<int> keyframes;     /**< 0-based keyframe numbers in ascending order */
+} IcVideoIndex;
+
+inline string icVideoIndexPath( const string& video )
+{
+    return video + ".icindex";
+}
+
+/**
+* Read a sidecar index. Fails if the video changed since it was indexed.
+*/
+bool icReadVideoIndex( const string& video, IcVideoIndex* index )
+{
+    ifstream ifs( icVideoIndexPath( video ).c_str() );
+    if( !ifs ) return false;
+    string magic, key;
+    size_t nkeyframes;
+    getline( ifs, magic );
+    if( magic != IC_VIDEOINDEX_MAGIC ) return false;
+    if( !( ifs >> key >> index->size >> key >> index->mtime
+               >> key >> index->nframes >> key >> nkeyframes ) ) return false;
+    index->keyframes.resize( nkeyframes );
+    for( size_t i = 0; i < nkeyframes; i++ )
+        if( !( ifs >> index->keyframes[i] ) ) return false;
+    index->path = video;
+    return index->size == fs::file_size( video ) && index->mtime == fs::last_write_time( video );
+}
+
+bool icWriteVideoIndex( const IcVideoIndex* index )
+{
+    string path = icVideoIndexPath( index->path );
+    {
+        ofstream ofs( ( path + ".tmp" ).c_str() );
+        if( !ofs ) return false;
+        ofs << IC_VIDEOINDEX_MAGIC << endl;
+        ofs << "size " << index->size << endl;
+        ofs << "mtime " << index->mtime << endl;
+        ofs << "frames " << index->nframes << endl;
+        ofs << "keyframes " << index->keyframes.size() << endl;
+        for( size_t i = 0; i < index->keyframes.size(); i++ )
+            ofs << index->keyframes[i] << endl;
+        if( !ofs ) return false;
+    }
+    try
+    {
+        fs::rename( path + ".tmp", path );
+    }
+    catch( ... )
+    {
+        fs::remove( path + ".tmp" );
+        return false;
+    }
+    return true;
+}
+
+#ifdef HAVE_FFMPEG
+/**
+* Scan video packets without decoding them
+*/
+bool icScanVideoIndex( const string& video, IcVideoIndex* index )
+{
+    AVFormatContext* fmt = NULL;
+#if LIBAVFORMAT_VERSION_INT < AV_VERSION_INT(58, 9, 100)
+    av_register_all();
+#endif
+    if( avformat_open_input( &fmt, video.c_str(), NULL, NULL ) < 0 ) return false;
+    int stream = -1;
+    if( avformat_find_stream_info( fmt, NULL ) >= 0 )
+        stream = av_find_best_stream( fmt, AVMEDIA_TYPE_VIDEO, -1, -1, NULL, 0 );
+    if( stream < 0 )
+    {
+        avformat_close_input( &fmt );
+        return false;
+    }
+    index->nframes = 0;
+    index->keyframes.clear();
+    AVPacket* pkt = av_packet_alloc();
+    while( av_read_frame( fmt, pkt ) >= 0 )
+    {
+        if( pkt->stream_index == stream )
+        {
+            if( pkt->flags & AV_PKT_FLAG_KEY ) index->keyframes.push_back( index->nframes );
+            index->nframes++;
+        }
+        av_packet_unref( pkt );
+    }
+    av_packet_free( &pkt );
+    avformat_close_input( &fmt );
+    return index->nframes > 0;
+}
+#endif
+
+/**
+* Get the index of a video. Read from its sidecar file, or built and saved.
+*
+* Do not forget icReleaseVideoIndex( &ret );
+*
+* @param video The video filename
+* @return IcVideoIndex*. NULL if the video can not be indexed.
+*/
+IcVideoIndex* icCreateVideoIndex( const string& video )
+{
+    IcVideoIndex* index = new IcVideoIndex();
+    if( icReadVideoIndex( video, index ) ) return index;
+#ifdef HAVE_FFMPEG
+    index->path = video;
+    index->size = fs::file_size( video );
+    index->mtime = fs::last_write_time( video );
+    if( icScanVideoIndex( video, index ) )
+    {
+        icWriteVideoIndex( index );
+        return index;
+    }
+#endif
+    delete index;
+    return NULL;
+}
+
+void icReleaseVideoIndex( IcVideoIndex** index )
+{
+    delete *index;
+    *index = NULL;
+}
+
+/**
+* The nearest keyframe at or before a frame. -1 if unknown.
+*/
+inline int icVideoKeyframe( const IcVideoIndex* index, int frame )
+{
+    if( index == NULL || index->keyframes.empty() ) return -1;
+    vector<int>::const_iterator iter =
+        upper_bound( index->keyframes.begin(), index->keyframes.end(), frame );
+    if( iter == index->keyframes.begin() ) return -1;
+    return *(--iter);
+}
+
+/**
+* Read a frame decoding the minimum number of frames
+*
+* Decodes forward from the current position if no keyframe lies in between,
+* or seeks to the nearest keyframe before the frame and decodes forward.
+*
+* @param cap   The capture
+* @param index The video index. NULL to seek with CV_CAP_PROP_POS_FRAMES only.
+* @param pos   The 0-based number of the frame the capture decodes next. Updated.
+*              -1 if unknown.
+* @param frame The 0-based frame number
+* @return The frame owned by cap. NULL if not readable.
+*/
+IplImage* icVideoSeek( CvCapture* cap, const IcVideoIndex* index, int* pos, int frame )
+{
+    if( index != NULL && frame >= index->nframes ) return NULL;
+    int key = icVideoKeyframe( index, frame );
+    bool seek = ( key < 0 ) ? ( *pos != frame ) : ( *pos > frame || *pos < key );
+    if( seek )
+    {
+        *pos = ( key < 0 ) ? frame : key;
+        cvSetCaptureProperty( cap, CV_CAP_PROP_POS_FRAMES, *pos );
+    }
+    for( ; *pos < frame; (*pos)++ )
+    {
+        if( !cvGrabFrame( cap ) ) break;
+    }
+    IplImage* img = ( *pos == frame ) ? cvQueryFrame( cap ) : NULL;
+    *pos = ( img != NULL ) ? *pos + 1 : -1; // unknown position forces a seek next time
+    return img;
+}
+
+#endif
@@ -37,11 +37,21 @@
 #include "highgui.h"
 #include <stdio.h>
 #include <math.h>
+#include <chrono>
 #include <iostream>
 #include <string>
 #include <vector>
 #include "filesystem.h"
 #include "icformat.h"
+#include "icbatch.h"
+#include "iccatalog.h"
+#include "icdirscan.h"
+#include "icdisplay.h"
+#include "icprefetch.h"
+#include "icsavequeue.h"
+#include "icvideoindex.h"
+#include "icframebuffer.h"
+#include "icsurface.h"
 #include "cvdrawwatershed.h"
 #include "opencvx/cvrect32f.h"
 #include "opencvx/cvdrawrectangle.h"
@@ -57,7 +67,7 @@ using namespace std;
 typedef struct CvCallbackParam {
     const char* w_name;        /**< main window name */
     const char* miniw_name;    /**< sub window name */
-    IplImage* img_src;             /**< image to be shown */
+    IplImage* img_src;             /**< image to be shown. NULL until decoded at full resolution. */
     // config
     vector<string> imtypes;    /**< image file types */
     const char* output_format; /**< output filename format */
@@ -78,6 +88,21 @@ typedef struct CvCallbackParam {
     IplImage* img_display;							// Cache - Current image pointer
     float scale_factor;								// Cache - global scale factor
     float cap_scale_factor;							// Cache - scale factor of capture
+    IcPrefetch* prefetch;                           /**< decode-ahead of filelist */
+    IcPyramid* pyramid;                             /**< display pyramid of img_src */
+    bool own_display;                               /**< img_display is not a pyramid level */
+    IcSaveQueue* save_queue;                        /**< background writer of crops */
+    IcVideoIndex* video_index;                      /**< keyframes of video */
+    IcFrameBuffer* frame_buffer;                    /**< decoded frames of video */
+    IcSurface* surface;                             /**< img_display with overlay */
+    bool redraw;                                    /**< state changed since the last render */
+    bool resample;                                  /**< view moved since img_display was resampled */
+    IcDirScan* dirscan;                             /**< background directory reading */
+    IcCatalog* catalog;                             /**< catalog of the directory */
+    IcPathParts parts;                              /**< components of the current filename */
+    IcTiledImage* tiled;                            /**< tiles of a large TIFF instead of img_src */
+    IcViewport view;                                /**< region of the scaled image shown as img_display */
+    int interpolation;                              /**< sampling of rotated and sheared crops */
 } CvCallbackParam ;
 
 /**
@@ -90,6 +115,20 @@ typedef struct ArgParam {
     const char* vidout_format;
     const char* output_format;
     int   frame;
+    const char* batch;
+    bool  dry_run;
+    int   jobs;
+    int   ahead;
+    int   behind;
+    int   cache_mb;
+    int   file_cache_mb;
+    int   save_queue;
+    int   frame_buffer_mb;
+    int   refresh;
+    bool  recursive;
+    vector<string> include;
+    vector<string> exclude;
+    int   interpolation;
 } ArgParam;
 
 /************************* Function Prototypes ******************************/
@@ -99,6 +138,14 @@ void gui_usage();
 void mouse_callback( int event, int x, int y, int flags, void* _param );
 void load_reference( const ArgParam* arg, CvCallbackParam* param );
 void key_callback( const ArgParam* arg, CvCallbackParam* param );
+bool key_command( CvCallbackParam* param, char key, string& filename, int repeat = 1, bool display = true );
+void render( CvCallbackParam* param );
+bool show_file( CvCallbackParam* param, long index, bool display = true );
+bool step_filelist( CvCallbackParam* param, int step, bool display = true );
+void load_frame( CvCallbackParam* param, IplImage* frame );
+void update_display( CvCallbackParam* param );
+bool update_source( CvCallbackParam* param, bool wait );
+void update_filelist( CvCallbackParam* param );
 
 /************************* Main **********************************************/
 
@@ -126,7 +173,22 @@ int main( int argc, char *argv[] )
         cvSize(0, 0),
         NULL,
         1.0f,		// global scale factor
-        2.0f		// scale factor of capture
+        2.0f,		// scale factor of capture
+        NULL,
+        NULL,
+        false,
+        NULL,
+        NULL,
+        NULL,
+        NULL,
+        false,
+        false,
+        NULL,
+        NULL,
+        IcPathParts(),
+        NULL,
+        icViewport( cvSize( 0, 0 ) ),
+        CV_INTER_NN
     };
     {
         init_param.imtypes.push_back( "bmp" );
@@ -136,11 +198,12 @@ int main( int argc, char *argv[] )
         init_param.imtypes.push_back( "jpe" );
         init_param.imtypes.push_back( "png" );
         init_param.imtypes.push_back( "pbm" );
-        init_param.imtypes.push_back( "pbm" );
+        init_param.imtypes.push_back( "pgm" );
         init_param.imtypes.push_back( "ppm" );
         init_param.imtypes.push_back( "sr" );
         init_param.imtypes.push_back( "ras" );
         init_param.imtypes.push_back( "tiff" );
+        init_param.imtypes.push_back( "tif" );
         init_param.imtypes.push_back( "exr" );
         init_param.imtypes.push_back( "jp2" );
     }
@@ -152,22 +215,63 @@ int main( int argc, char *argv[] )
         "%d/image_clipper/%i.%e_%04r_%04x_%04y_%04w_%04h.png",
         "%d/image_clipper/%i.%e_%04f_%04r_%04x_%04y_%04w_%04h.png",
         NULL,
-        1
+        1,
+        NULL,
+        false,
+        0,
+        4,
+        2,
+        1024,
+        2048,
+        64,
+        512,
+        60,
+        false,
+        vector<string>(),
+        vector<string>(),
+        CV_INTER_NN
     };
     ArgParam *arg = &init_arg;
 
     // parse arguments
     arg_parse( argc, argv, arg );
+    if( arg->batch != NULL )
+    {
+        long failed = icBatchCrop( arg->batch, param->imtypes,
+                                   arg->output_format != NULL ? arg->output_format : arg->imgout_format,
+                                   arg->output_format != NULL ? arg->output_format : arg->vidout_format,
+                                   arg->jobs, arg->dry_run, arg->interpolation );
+        return failed == 0 ? 0 : 1;
+    }
     gui_usage();
+    param->surface = icCreateSurface();
+    param->interpolation = arg->interpolation;
     load_reference( arg, param );
 
     // Mouse and Key callback
     cvNamedWindow( param->w_name, CV_WINDOW_AUTOSIZE );
     cvNamedWindow( param->miniw_name, CV_WINDOW_AUTOSIZE );
     cvSetMouseCallback( param->w_name, mouse_callback, param );
+    param->save_queue = icCreateSaveQueue( arg->save_queue );
     key_callback( arg, param );
     cvDestroyWindow( param->w_name );
     cvDestroyWindow( param->miniw_name );
+    icReleaseSaveQueue( &param->save_queue );
+    icReleaseDirScan( &param->dirscan );
+    if( param->catalog && param->catalog->dirty ) icWriteCatalog( param->catalog );
+    icReleaseCatalog( &param->catalog );
+    if( param->prefetch )
+    {
+        cerr << "Prefetch: " << param->prefetch->hits << " hits, " << param->prefetch->misses << " misses." << endl;
+        cerr << "File cache: " << param->prefetch->files->hits << " hits, "
+             << param->prefetch->files->misses << " misses." << endl;
+        icReleasePrefetch( &param->prefetch );
+    }
+    if( param->cap ) icReleasePyramid( &param->pyramid );
+    icReleaseFrameBuffer( &param->frame_buffer );
+    icReleaseVideoIndex( &param->video_index );
+    if( param->cap ) cvReleaseCapture( &param->cap );
+    icReleaseSurface( &param->surface );
 }
 
 /**
@@ -182,39 +286,72 @@ void load_reference( const ArgParam* arg, CvCallbackParam* param )
                                                           ( is_video ? arg->vidout_format : arg->imgout_format ) );
     param->frame = arg->frame;
 
+    // get screen resolution
+#ifdef WIN32
+    param->screen_size.width = GetSystemMetrics(SM_CXSCREEN);
+    param->screen_size.height = GetSystemMetrics(SM_CYSCREEN);
+#else
+    param->screen_size.width = 1400;
+    param->screen_size.height = 800;
+#endif // WIN32
+    param->view = icViewport( param->screen_size );
+
     if( is_directory || is_image )
     {
+        if( !is_directory && !fs::exists( arg->reference ) )
+        {
+            cerr << "The image file " << fs::realpath( arg->reference ) << " does not exist." << endl << endl;
+            usage( arg );
+            exit(1);
+        }
         cerr << "Now reading a directory..... ";
+        string dirpath = is_directory ? arg->reference : fs::dirname( arg->reference );
+        // catalogs hold every image of one directory
+        bool catalog_ok = !( is_directory && arg->recursive ) && arg->include.empty() && arg->exclude.empty();
+        IcCatalog* catalog = catalog_ok ? icReadCatalog( dirpath ) : NULL;
+        if( catalog != NULL && icCatalogValid( catalog ) )
+        {
+            param->catalog = catalog;
+            param->filelist = icCatalogFilelist( catalog );
+        }
+        else
+        {
+            // an image file is shown first and its directory is read behind it
+            param->dirscan = icCreateDirScan( dirpath, param->imtypes, catalog, is_directory && arg->recursive,
+                                              arg->include, arg->exclude, arg->jobs > 0 ? arg->jobs : 16 );
+            if( is_directory ) icDirScanTake( param->dirscan, param->filelist, true );
+        }
         if( is_directory )
         {
-            param->filelist = fs::filelist( arg->reference, param->imtypes, "file" );
             if( param->filelist.empty() )
             {
                 cerr << "No image file exist under a directory " << fs::realpath( arg->reference ) << endl << endl;
                 usage( arg );
                 exit(1);
             }
-            sort(param->filelist.begin(),param->filelist.end());
             param->fileiter = param->filelist.begin();
         }
         else
         {
-            if( !fs::exists( arg->reference ) )
-            {
-                cerr << "The image file " << fs::realpath( arg->reference ) << " does not exist." << endl << endl;
-                usage( arg );
-                exit(1);
-            }
-            param->filelist = fs::filelist( fs::dirname( arg->reference ), param->imtypes, "file" );
-            // step up till specified file
-            for( param->fileiter = param->filelist.begin(); param->fileiter != param->filelist.end(); param->fileiter++ )
-            {
-                if( fs::realpath( *param->fileiter ) == fs::realpath( arg->reference ) ) break;
-            }
+            param->fileiter = lower_bound( param->filelist.begin(), param->filelist.end(), arg->reference );
+            if( param->fileiter == param->filelist.end() || *param->fileiter != arg->reference )
+                param->fileiter = param->filelist.insert( param->fileiter, arg->reference );
         }
         cerr << "Done!" << endl;
-        param->img_src = cvLoadImage( fs::realpath( *param->fileiter ).c_str() );
-        cerr << "Now showing " << fs::realpath( *param->fileiter ) << " | width:" << param->img_src->width << ", height:" << param->img_src->height << endl;
+        param->prefetch = icCreatePrefetch( &param->filelist, param->screen_size,
+                                            arg->ahead, arg->behind, (size_t)arg->cache_mb << 20,
+                                            (size_t)arg->file_cache_mb << 20 );
+        if( !icPrefetchGet( param->prefetch, param->fileiter - param->filelist.begin(),
+                            &param->img_src, &param->pyramid, &param->scale_factor ) )
+        {
+            cerr << "The image file " << fs::realpath( *param->fileiter ) << " is not loadable." << endl << endl;
+            usage( arg );
+            exit(1);
+        }
+        param->tiled = icPrefetchTiled( param->prefetch, param->fileiter - param->filelist.begin() );
+        update_display( param );
+        param->parts = icCatalogSplitPath( param->catalog, *param->fileiter );
+        cerr << "Now showing " << fs::realpath( *param->fileiter ) << " | width:" << param->pyramid->size.width << ", height:" << param->pyramid->size.height << endl;
     }
     else if( is_video )
     {
@@ -226,21 +363,23 @@ void load_reference( const ArgParam* arg, CvCallbackParam* param )
         }
         cerr << "Now reading a video..... ";
         param->cap = cvCaptureFromFile( fs::realpath( arg->reference ).c_str() );
-        cvSetCaptureProperty( param->cap, CV_CAP_PROP_POS_FRAMES, arg->frame - 1 );
-        param->img_src = cvQueryFrame( param->cap );
-        if( param->img_src == NULL )
+        param->video_index = icCreateVideoIndex( fs::realpath( arg->reference ) );
+        param->frame_buffer = icCreateFrameBuffer( param->cap, param->video_index, (size_t)arg->frame_buffer_mb << 20 );
+        IplImage* frame = param->cap == NULL ? NULL : icFrameBufferGet( param->frame_buffer, arg->frame - 1 );
+        if( frame == NULL )
         {
             cerr << "The file " << fs::realpath( arg->reference ) << " was assumed as a video, but not loadable." << endl << endl;
             usage( arg );
             exit(1);
         }
         cerr << "Done!" << endl;
-        cerr << cvGetCaptureProperty( param->cap, CV_CAP_PROP_FRAME_COUNT ) << " frames totally." << endl;
+        if( param->video_index != NULL )
+            cerr << param->video_index->nframes << " frames and " << param->video_index->keyframes.size() << " keyframes totally." << endl;
+        else
+            cerr << cvGetCaptureProperty( param->cap, CV_CAP_PROP_FRAME_COUNT ) << " frames totally." << endl;
         cerr << "Now showing " << fs::realpath( arg->reference ) << " " << arg->frame << endl;
-#if (defined(WIN32) || defined(WIN64)) && (CV_MAJOR_VERSION < 1 || (CV_MAJOR_VERSION == 1 && CV_MINOR_VERSION < 1))
-        param->img->origin = 0;
-        cvFlip( param->img );
-#endif
+        param->parts = icSplitPath( arg->reference );
+        load_frame( param, frame );
     }
     else
     {
@@ -248,521 +387,616 @@ void load_reference( const ArgParam* arg, CvCallbackParam* param )
         usage( arg );
         exit(1);
     }
+}
 
-    // get screen resolution
-#ifdef WIN32
-    param->screen_size.width = GetSystemMetrics(SM_CXSCREEN);
-    param->screen_size.height = GetSystemMetrics(SM_CYSCREEN);
-#else
-    param->screen_size.width = 1400;
-    param->screen_size.height = 800;
-#endif // WIN32
+/**
+ * Event loop
+ *
+ * Mouse and key events only update param. Key auto-repeat queued during a
+ * render is drained and applied at once, and the windows are redrawn at most
+ * once per display refresh from the latest state, so that the view never
+ * lags behind a stream of stale redraws.
+ */
+void key_callback( const ArgParam* arg, CvCallbackParam* param )
+{
+    string filename = param->cap == NULL ? *param->fileiter : arg->reference;
+    const chrono::milliseconds interval( 1000 / max( 1, arg->refresh ) );
+    chrono::steady_clock::time_point rendered = chrono::steady_clock::now();
+    render( param );
 
-    // resize image to fit screen resolution
+    int pending = -1;
+    while( true )
     {
-        CvSize _size = cvSize(param->img_src->width, param->img_src->height);
-        if (_size.width > param->screen_size.width || _size.height > param->screen_size.height) {
-            _size.width /= 2;
-            _size.height /= 2;
-            param->scale_factor /= 2;
-            if (_size.width > param->screen_size.width || _size.height > param->screen_size.height) {
-                _size.width /= 2;
-                _size.height /= 2;
-                param->scale_factor /= 2;
+        // mouse_callback is dispatched inside cvWaitKey
+        int wait = (int)interval.count();
+        if( param->redraw )
+        {
+            chrono::milliseconds elapsed = chrono::duration_cast<chrono::milliseconds>( chrono::steady_clock::now() - rendered );
+            wait = (int)max( (chrono::milliseconds::rep)1, ( interval - elapsed ).count() );
+        }
+        int key = pending != -1 ? pending : cvWaitKey( wait );
+        pending = -1;
+        update_filelist( param );
+        update_source( param, false );
+        if( key != -1 )
+        {
+            // fold key auto-repeat into one update
+            int repeat = 1;
+            while( ( pending = cvWaitKey( 1 ) ) == key ) repeat++;
+            if( key == 'f' || key == 'b' )
+            {
+                // one jump, so that only the image landed on is decoded and resampled
+                if( !key_command( param, (char)key, filename, repeat ) ) return;
             }
-            if (_size.width > param->screen_size.width || _size.height > param->screen_size.height) {
-                _size.width /= 2;
-                _size.height /= 2;
-                param->scale_factor /= 2;
+            else if( key == 32 )
+            {
+                // each SPACE saves a crop of another image, so step through them
+                // but resample only the last one. The watershed needs each shown.
+                for( int i = 0; i < repeat; i++ )
+                {
+                    if( !key_command( param, (char)key, filename, 1, param->watershed || i + 1 == repeat ) ) return;
+                }
+            }
+            else
+            {
+                for( int i = 0; i < repeat; i++ )
+                {
+                    if( !key_command( param, (char)key, filename ) ) return;
+                }
             }
-        }else{
-            param->scale_factor=1.0f;
         }
-        param->img_display = cvCreateImage(_size, param->img_src->depth, param->img_src->nChannels);
-        cvResize(param->img_src, param->img_display);
+        if( param->redraw && chrono::steady_clock::now() - rendered >= interval )
+        {
+            render( param );
+            rendered = chrono::steady_clock::now();
+        }
     }
 }
 
 /**
- * Keyboard operations
+ * Draw the rectangle or watershed on the main window and the crop on the sub window
+ *
+ * img_display is resampled first if the view was panned since.
  */
-void key_callback( const ArgParam* arg, CvCallbackParam* param )
+void render( CvCallbackParam* param )
 {
-    string filename = param->cap == NULL ? *param->fileiter : arg->reference;
-
-    param->scale_factor=1.0f;
-    CvSize _size = cvSize(param->img_src->width, param->img_src->height);
-    if (_size.width > param->screen_size.width || _size.height > param->screen_size.height) {
-        _size.width /= 2;
-        _size.height /= 2;
-        param->scale_factor /= 2;
-        if (_size.width > param->screen_size.width || _size.height > param->screen_size.height) {
-            _size.width /= 2;
-            _size.height /= 2;
-            param->scale_factor /= 2;
-        }
-        if (_size.width > param->screen_size.width || _size.height > param->screen_size.height) {
-            _size.width /= 2;
-            _size.height /= 2;
-            param->scale_factor /= 2;
-        }
-    }else{
-        param->scale_factor=1.0f;
+    if( param->resample && param->img_display ) update_display( param );
+    param->redraw = false;
+    if( !param->img_display ) return;
+    // img_display shows the viewport only
+    CvRect view = param->view.rect;
+    CvRect shown = cvRect( param->rect.x - view.x, param->rect.y - view.y, param->rect.width, param->rect.height );
+    if( param->watershed )
+    {
+        CvRect circle = cvRect( param->circle.x - view.x, param->circle.y - view.y, param->circle.width, param->circle.height );
+        shown = icSurfaceShowWatershed( param->surface, param->w_name, param->img_display, circle );
+        param->rect = cvRect( shown.x + view.x, shown.y + view.y, shown.width, shown.height );
     }
-    cout<<"Scale factorchanged to "<<param->scale_factor<<endl;
-    cvReleaseImage(&param->img_display);
-    param->img_display = cvCreateImage(
-                cvSize(param->img_src->width * param->scale_factor, param->img_src->height * param->scale_factor),
-                param->img_src->depth, param->img_src->nChannels);
-    cvResize(param->img_src, param->img_display);
-    cvShowImageAndRectangle(param->w_name, param->img_display, cvRect32fFromRect(param->rect, param->rotate), cvPointTo32f(param->shear));
-
-    if(param->scale_factor!=1.0f){
+    else
+    {
+        icSurfaceShowRectangle( param->surface, param->w_name, param->img_display,
+                                cvRect32fFromRect( shown, param->rotate ),
+                                cvPointTo32f( param->shear ) );
+    }
+    if( param->img_src )
+    {
+        float inv = 1 / param->scale_factor;
         cvShowCroppedImage( param->miniw_name, param->img_src,
-                            cvRect32f(param->rect.x*(1/param->scale_factor),param->rect.y*(1/param->scale_factor),param->rect.width*(1/param->scale_factor),param->rect.height*(1/param->scale_factor), param->rotate ),
+                            cvRect32f( param->rect.x * inv, param->rect.y * inv,
+                                       param->rect.width * inv, param->rect.height * inv, param->rotate ),
                             cvPointTo32f( param->shear ) );
-        cout<<"Scale factor is "<<param->scale_factor<<", Scaled crop image size is "<<param->rect.x*(1/param->scale_factor)<<", "<<param->rect.y*(1/param->scale_factor)<<", "<<param->rect.width*(1/param->scale_factor)<<", "<<param->rect.height*(1/param->scale_factor)<<endl;
-    }else{
-        cvShowCroppedImage( param->miniw_name, param->img_src,
-                            cvRect32fFromRect( param->rect, param->rotate ),
+    }
+    else if( param->tiled && param->rect.width > 0 && param->rect.height > 0 )
+    {
+        float inv = 1 / param->scale_factor;
+        IplImage* crop = icTiledCrop( param->tiled,
+                                      cvRect32f( param->rect.x * inv, param->rect.y * inv,
+                                                 param->rect.width * inv, param->rect.height * inv, param->rotate ),
+                                      cvPointTo32f( param->shear ) );
+        cvShowImage( param->miniw_name, crop );
+        cvReleaseImage( &crop );
+    }
+    else
+    {
+        // until the full resolution image is decoded
+        cvShowCroppedImage( param->miniw_name, param->img_display,
+                            cvRect32fFromRect( shown, param->rotate ),
                             cvPointTo32f( param->shear ) );
-        cout<<"Scale factor is "<<param->scale_factor<<", Unscaled crop image size is "<<param->rect.x<<", "<<param->rect.y<<", "<<param->rect.width<<", "<<param->rect.height<<endl;
     }
-    cvShowImageAndRectangle( param->w_name, param->img_display,
-                             cvRect32fFromRect( param->rect, param->rotate ),
-                             cvPointTo32f( param->shear ) );
+}
 
-    //    cvShowCroppedImage( param->miniw_name, param->img_src,
-    //        cvRect32fFromRect( param->rect, param->rotate ),
-    //        cvPointTo32f( param->shear ) );
-    //    cvShowImageAndRectangle( param->w_name, param->img_display,
-    //        cvRect32fFromRect( param->rect, param->rotate ),
-    //        cvPointTo32f( param->shear ) );
+/**
+ * Keyboard operations
+ *
+ * @param [repeat = 1] The times the key is pressed. Forward and backward
+ *                     move that many images or frames at once.
+ * @param [display = true] Resample the image moved to. See show_file.
+ * @return false to quit
+ */
+bool key_command( CvCallbackParam* param, char key, string& filename, int repeat, bool display )
+{
+    cout << "Key pressed: " << (int)key << endl;
 
-    while( true ) // key callback
-    {
-        char key = cvWaitKey( 0 );
-        cout << "Key pressed: " << (int)key << endl;
+    if (key == '+' || key == '-') {
+        float scale_factor = param->scale_factor * ( key == '+' ? 1.05f : 0.95f );
+        // zoom around the center of the window
+        icViewportZoom( &param->view, param->pyramid->size, param->scale_factor, scale_factor,
+                        cvPoint( param->view.rect.width / 2, param->view.rect.height / 2 ) );
+        param->scale_factor = scale_factor;
 
-        if (key == '+') {
-            param->scale_factor *= 1.05;
+        cout<<"Scale factorchanged to "<<param->scale_factor<<endl;
+        update_display( param );
+    }
 
-            cout<<"Scale factorchanged to "<<param->scale_factor<<endl;
-            cvReleaseImage(&param->img_display);
-            param->img_display = cvCreateImage(
-                        cvSize(param->img_src->width * param->scale_factor, param->img_src->height * param->scale_factor),
-                        param->img_src->depth, param->img_src->nChannels);
-            cvResize(param->img_src, param->img_display);
-            cvShowImageAndRectangle(param->w_name, param->img_display, cvRect32fFromRect(param->rect, param->rotate), cvPointTo32f(param->shear));
-        }
+    // Pan by a quarter of the window (vi-like keybinds with SHIFT)
+    if( key == 'H' || key == 'J' || key == 'K' || key == 'L' )
+    {
+        int dx = param->view.rect.width / 4, dy = param->view.rect.height / 4;
+        icViewportPan( &param->view, param->pyramid->size, param->scale_factor,
+                       key == 'H' ? -dx : key == 'L' ? dx : 0, key == 'K' ? -dy : key == 'J' ? dy : 0 );
+        update_display( param );
+    }
 
-        if (key == '-') {
-            param->scale_factor *= 0.95;
 
-            cout<<"Scale factorchanged to "<<param->scale_factor<<endl;
-            cvReleaseImage(&param->img_display);
-            param->img_display = cvCreateImage(
-                        cvSize(param->img_src->width * param->scale_factor, param->img_src->height * param->scale_factor),
-                        param->img_src->depth, param->img_src->nChannels);
-            cvResize(param->img_src, param->img_display);
-            cvShowImageAndRectangle(param->w_name, param->img_display, cvRect32fFromRect(param->rect, param->rotate), cvPointTo32f(param->shear));
+    // 32 is SPACE
+    if( key == 's' || key == 32 ) // Save
+    {
+        // the watershed rectangle is determined on rendering
+        if( param->watershed && param->redraw ) render( param );
+        if( param->rect.width > 0 && param->rect.height > 0 && !param->tiled && !update_source( param, true ) )
+        {
+            cerr << "The image file " << fs::realpath( *param->fileiter ) << " is not loadable. Not saved." << endl;
         }
-
-
-        // 32 is SPACE
-        if( key == 's' || key == 32 ) // Save
+        else if( param->rect.width > 0 && param->rect.height > 0 )
         {
-            if( param->rect.width > 0 && param->rect.height > 0 )
+            string output_path;
+            if(param->scale_factor!=1.0f){
+                output_path= icFormat(
+                            param->output_format, param->parts.dirname,
+                            param->parts.filename, param->parts.extension,
+                            param->rect.x*(1/param->scale_factor), param->rect.y*(1/param->scale_factor), param->rect.width*(1/param->scale_factor), param->rect.height*(1/param->scale_factor),
+                            param->frame, param->rotate );
+                cout<<"Scale factor is "<<param->scale_factor<<", Scaled Rect is "<<param->rect.x*(1/param->scale_factor)<<", "<<param->rect.y*(1/param->scale_factor)<<", "<<param->rect.width*(1/param->scale_factor)<<", "<<param->rect.height*(1/param->scale_factor)<<endl;
+            }else{
+                output_path = icFormat(
+                            param->output_format, param->parts.dirname,
+                            param->parts.filename, param->parts.extension,
+                            param->rect.x, param->rect.y, param->rect.width, param->rect.height,
+                            param->frame, param->rotate );
+                cout<<"Scale factor is "<<param->scale_factor<<", Unscaled Rect is "<<param->rect.x<<", "<<param->rect.y<<", "<<param->rect.width<<", "<<param->rect.height<<endl;
+            }
+            if( !fs::match_extensions( output_path, param->imtypes ) )
             {
-                string output_path;
-                if(param->scale_factor!=1.0f){
-                    output_path= icFormat(
-                                param->output_format, fs::dirname( filename ),
-                                fs::filename( filename ), fs::extension( filename ),
-                                param->rect.x*(1/param->scale_factor), param->rect.y*(1/param->scale_factor), param->rect.width*(1/param->scale_factor), param->rect.height*(1/param->scale_factor),
-                                param->frame, param->rotate );
-                    cout<<"Scale factor is "<<param->scale_factor<<", Scaled Rect is "<<param->rect.x*(1/param->scale_factor)<<", "<<param->rect.y*(1/param->scale_factor)<<", "<<param->rect.width*(1/param->scale_factor)<<", "<<param->rect.height*(1/param->scale_factor)<<endl;
-                }else{
-                    output_path = icFormat(
-                                param->output_format, fs::dirname( filename ),
-                                fs::filename( filename ), fs::extension( filename ),
-                                param->rect.x, param->rect.y, param->rect.width, param->rect.height,
-                                param->frame, param->rotate );
-                    cout<<"Scale factor is "<<param->scale_factor<<", Unscaled Rect is "<<param->rect.x<<", "<<param->rect.y<<", "<<param->rect.width<<", "<<param->rect.height<<endl;
-                }
-                if( !fs::match_extensions( output_path, param->imtypes ) )
-                {
-                    cerr << "The image type " << fs::extension( output_path ) << " is not supported." << endl;
-                    exit(1);
-                }
-                fs::create_directories( fs::dirname( output_path ) );
+                cerr << "The image type " << fs::extension( output_path ) << " is not supported." << endl;
+                exit(1);
+            }
 
-                IplImage* crop;
-                if(param->scale_factor!=1.0f){
-                    crop = cvCreateImage(
-                                cvSize( param->rect.width*(1/param->scale_factor), param->rect.height*(1/param->scale_factor) ),
-                                param->img_src->depth, param->img_src->nChannels );
-                    cvCropImageROI( param->img_src, crop,
-                                    cvRect32f( param->rect.x*(1/param->scale_factor), param->rect.y*(1/param->scale_factor), param->rect.width*(1/param->scale_factor), param->rect.height*(1/param->scale_factor), param->rotate ),
-                                    cvPointTo32f( param->shear ) );
-                    cout<<"Scale factor is "<<param->scale_factor<<", Scaled crop image size is "<<param->rect.x*(1/param->scale_factor)<<", "<<param->rect.y*(1/param->scale_factor)<<", "<<param->rect.width*(1/param->scale_factor)<<", "<<param->rect.height*(1/param->scale_factor)<<endl;
-                }else{
-                    crop = cvCreateImage(
-                                cvSize( param->rect.width, param->rect.height ),
-                                param->img_src->depth, param->img_src->nChannels );
-                    cvCropImageROI( param->img_src, crop,
-                                    cvRect32fFromRect( param->rect, param->rotate ),
-                                    cvPointTo32f( param->shear ) );
-                    cout<<"Scale factor is "<<param->scale_factor<<", Unscaled crop image size is "<<param->rect.x<<", "<<param->rect.y<<", "<<param->rect.width<<", "<<param->rect.height<<endl;
-                }
-                cvSaveImage( fs::realpath( output_path ).c_str(), crop );
-                cout << fs::realpath( output_path ) << endl;
-                cvReleaseImage( &crop );
+            IplImage* crop;
+            if( param->tiled )
+            {
+                // only the tiles under the rectangle are read
+                float inv = 1 / param->scale_factor;
+                crop = icTiledCrop( param->tiled,
+                                    cvRect32f( param->rect.x * inv, param->rect.y * inv,
+                                               param->rect.width * inv, param->rect.height * inv, param->rotate ),
+                                    cvPointTo32f( param->shear ), param->interpolation );
+            }
+            else if(param->scale_factor!=1.0f){
+                crop = cvCreateImage(
+                            cvSize( param->rect.width*(1/param->scale_factor), param->rect.height*(1/param->scale_factor) ),
+                            param->img_src->depth, param->img_src->nChannels );
+                cvCropImageROI( param->img_src, crop,
+                                cvRect32f( param->rect.x*(1/param->scale_factor), param->rect.y*(1/param->scale_factor), param->rect.width*(1/param->scale_factor), param->rect.height*(1/param->scale_factor), param->rotate ),
+                                cvPointTo32f( param->shear ), param->interpolation );
+                cout<<"Scale factor is "<<param->scale_factor<<", Scaled crop image size is "<<param->rect.x*(1/param->scale_factor)<<", "<<param->rect.y*(1/param->scale_factor)<<", "<<param->rect.width*(1/param->scale_factor)<<", "<<param->rect.height*(1/param->scale_factor)<<endl;
+            }else{
+                crop = cvCreateImage(
+                            cvSize( param->rect.width, param->rect.height ),
+                            param->img_src->depth, param->img_src->nChannels );
+                cvCropImageROI( param->img_src, crop,
+                                cvRect32fFromRect( param->rect, param->rotate ),
+                                cvPointTo32f( param->shear ), param->interpolation );
+                cout<<"Scale factor is "<<param->scale_factor<<", Unscaled crop image size is "<<param->rect.x<<", "<<param->rect.y<<", "<<param->rect.width<<", "<<param->rect.height<<endl;
             }
+            // encoded and written in background
+            cout << fs::realpath( output_path ) << endl;
+            icSaveQueuePush( param->save_queue, fs::realpath( output_path ), crop );
         }
-        // Forward
-        if( key == 'f' || key == 32 ) // 32 is SPACE
+    }
+    // Forward
+    if( key == 'f' || key == 32 ) // 32 is SPACE
+    {
+        if( param->cap )
         {
-            if( param->cap )
+            // the last readable frame up to repeat frames ahead
+            int frame = param->frame + repeat - 1;
+            if( param->video_index != NULL ) frame = min( frame, param->video_index->nframes - 1 );
+            IplImage* tmpimg = NULL;
+            while( frame >= param->frame && ( tmpimg = icFrameBufferGet( param->frame_buffer, frame ) ) == NULL )
+                frame--;
+            if( tmpimg != NULL )
+                //if( frame < cvGetCaptureProperty( param->cap, CV_CAP_PROP_FRAME_COUNT ) )
             {
-                IplImage* tmpimg = cvQueryFrame( param->cap );
-                if( tmpimg != NULL )
-                    //if( frame < cvGetCaptureProperty( param->cap, CV_CAP_PROP_FRAME_COUNT ) )
-                {
-                    param->img_src = tmpimg;
-                    {
-                        CvSize _size = cvSize(param->img_src->width, param->img_src->height);
-                        while (_size.width > param->screen_size.width || _size.height > param->screen_size.height) {
-                            _size.width /= 2;
-                            _size.height /= 2;
-                            param->scale_factor /= 2;
-                        }
-                        param->img_display = cvCreateImage(_size, param->img_src->depth, param->img_src->nChannels);
-                        cvResize(param->img_src, param->img_display);
-                    }
-#if (defined(WIN32) || defined(WIN64)) && (CV_MAJOR_VERSION < 1 || (CV_MAJOR_VERSION == 1 && CV_MINOR_VERSION < 1))
-                    param->img_src->origin = 0;
-                    cvFlip( param->img_src );
-#endif
-                    param->frame++;
-                    cout << "Now showing " << fs::realpath( filename ) << " " <<  param->frame << endl;
-                }
+                load_frame( param, tmpimg );
+                param->frame = frame + 1;
+                cout << "Now showing " << filename << " " <<  param->frame << endl;
             }
-            else
+        }
+        else
+        {
+            if( step_filelist( param, +repeat, display ) )
             {
-                if( param->fileiter + 1 != param->filelist.end() )
-                {
-                    cvReleaseImage( &param->img_src );
-                    param->fileiter++;
-                    filename = *param->fileiter;
-                    param->img_src = cvLoadImage( fs::realpath( filename ).c_str() );
-                    {
-                        param->scale_factor=1.0f;
-                        CvSize _size = cvSize(param->img_src->width, param->img_src->height);
-                        if (_size.width > param->screen_size.width || _size.height > param->screen_size.height) {
-                            _size.width /= 2;
-                            _size.height /= 2;
-                            param->scale_factor /= 2;
-                            if (_size.width > param->screen_size.width || _size.height > param->screen_size.height) {
-                                _size.width /= 2;
-                                _size.height /= 2;
-                                param->scale_factor /= 2;
-                            }
-                            if (_size.width > param->screen_size.width || _size.height > param->screen_size.height) {
-                                _size.width /= 2;
-                                _size.height /= 2;
-                                param->scale_factor /= 2;
-                            }
-                        }else{
-                            param->scale_factor=1.0f;
-                        }
-                        param->img_display = cvCreateImage(_size, param->img_src->depth, param->img_src->nChannels);
-                        cvResize(param->img_src, param->img_display);
-                    }
-                    cout << "Now showing " << fs::realpath( filename ) << " | width:" << param->img_src->width <<", height:" << param->img_src->height << endl;
-                }
+                filename = *param->fileiter;
+                cout << "Now showing " << filename << " | width:" << param->pyramid->size.width <<", height:" << param->pyramid->size.height << endl;
             }
         }
-        // Backward
-        else if( key == 'b' )
+    }
+    // Backward
+    else if( key == 'b' )
+    {
+        if( param->cap )
         {
-            if( param->cap )
+            IplImage* tmpimg;
+            param->frame = max( 1, param->frame - repeat );
+            if( tmpimg = icFrameBufferGet( param->frame_buffer, param->frame - 1 ) )
             {
-                IplImage* tmpimg;
-                param->frame = max( 1, param->frame - 1 );
-                cvSetCaptureProperty( param->cap, CV_CAP_PROP_POS_FRAMES, param->frame - 1 );
-                if( tmpimg = cvQueryFrame( param->cap ) )
-                {
-                    param->img_src = tmpimg;
-                    {
-                        CvSize _size = cvSize(param->img_src->width, param->img_src->height);
-                        if (_size.width > param->screen_size.width || _size.height > param->screen_size.height) {
-                            _size.width /= 2;
-                            _size.height /= 2;
-                            param->scale_factor /= 2;
-                        }else{
-                            param->scale_factor=1.0f;
-                        }
-                        param->img_display = cvCreateImage(_size, param->img_src->depth, param->img_src->nChannels);
-                        cvResize(param->img_src, param->img_display);
-                    }
-#if (defined(WIN32) || defined(WIN64)) && (CV_MAJOR_VERSION < 1 || (CV_MAJOR_VERSION == 1 && CV_MINOR_VERSION < 1))
-                    param->img_src->origin = 0;
-                    cvFlip( param->img_src );
-#endif
-                    cout << "Now showing " << fs::realpath( filename ) << " " <<  param->frame << endl;
-                }
+                load_frame( param, tmpimg );
+                cout << "Now showing " << filename << " " <<  param->frame << endl;
             }
-            else
+        }
+        else
+        {
+            if( step_filelist( param, -repeat ) )
             {
-                if( param->fileiter != param->filelist.begin() )
-                {
-                    cvReleaseImage( &param->img_src );
-                    param->fileiter--;
-                    filename = *param->fileiter;
-                    param->img_src = cvLoadImage( fs::realpath( filename ).c_str() );
-                    {
-                        param->scale_factor=1.0f;
-                        CvSize _size = cvSize(param->img_src->width, param->img_src->height);
-                        if (_size.width > param->screen_size.width || _size.height > param->screen_size.height) {
-                            _size.width /= 2;
-                            _size.height /= 2;
-                            param->scale_factor /= 2;
-                            if (_size.width > param->screen_size.width || _size.height > param->screen_size.height) {
-                                _size.width /= 2;
-                                _size.height /= 2;
-                                param->scale_factor /= 2;
-                            }
-                            if (_size.width > param->screen_size.width || _size.height > param->screen_size.height) {
-                                _size.width /= 2;
-                                _size.height /= 2;
-                                param->scale_factor /= 2;
-                            }
-                        }else{
-                            param->scale_factor=1.0f;
-                        }
-                        param->img_display = cvCreateImage(_size, param->img_src->depth, param->img_src->nChannels);
-                        cvResize(param->img_src, param->img_display);
-                    }
-                    cout << "Now showing " << fs::realpath( filename ) << " | width:" << param->img_src->width <<", height:" << param->img_src->height << endl;
-                }
+                filename = *param->fileiter;
+                cout << "Now showing " << filename << " | width:" << param->pyramid->size.width <<", height:" << param->pyramid->size.height << endl;
             }
         }
-        // Exit
-        else if( key == 'q' || key == 27 ) // 27 is ESC
+    }
+    // Exit
+    else if( key == 'q' || key == 27 ) // 27 is ESC
+    {
+        return false;
+    }
+    else if( key == '+' )
+    {
+        param->inc += 1;
+        cout << "Inc: " << param->inc << endl;
+    }
+    else if( key == '-' )
+    {
+        param->inc = max( 1, param->inc - 1 );
+        cout << "Inc: " << param->inc << endl;
+    }
+
+    if( param->watershed ) // watershed
+    {
+        // Rectangle Movement (Vi like hotkeys)
+        if( key == 'h' ) // Left
         {
-            break;
+            param->circle.x -= param->inc;
         }
-        else if( key == '+' )
+        else if( key == 'j' ) // Down
         {
-            param->inc += 1;
-            cout << "Inc: " << param->inc << endl;
+            param->circle.y += param->inc;
         }
-        else if( key == '-' )
+        else if( key == 'k' ) // Up
         {
-            param->inc = max( 1, param->inc - 1 );
-            cout << "Inc: " << param->inc << endl;
+            param->circle.y -= param->inc;
         }
-
-        if( param->watershed ) // watershed
+        else if( key == 'l' ) // Right
         {
-            // Rectangle Movement (Vi like hotkeys)
-            if( key == 'h' ) // Left
-            {
-                param->circle.x -= param->inc;
-            }
-            else if( key == 'j' ) // Down
-            {
-                param->circle.y += param->inc;
-            }
-            else if( key == 'k' ) // Up
-            {
-                param->circle.y -= param->inc;
-            }
-            else if( key == 'l' ) // Right
-            {
-                param->circle.x += param->inc;
-            }
-            // Rectangle Resize
-            else if( key == 'y' ) // Shrink width
-            {
-                param->circle.width -= param->inc;
-            }
-            else if( key == 'u' ) // Expand height
-            {
-                param->circle.width += param->inc;
-            }
-            else if( key == 'i' ) // Shrink height
-            {
-                param->circle.width -= param->inc;
-            }
-            else if( key == 'o' ) // Expand width
-            {
-                param->circle.width += param->inc;
-            }
-            // Shear Deformation
-            else if( key == 'n' ) // Left
-            {
-                param->shear.x -= param->inc;
-            }
-            else if( key == 'm' ) // Down
-            {
-                param->shear.y += param->inc;
-            }
-            else if( key == ',' ) // Up
-            {
-                param->shear.y -= param->inc;
-            }
-            else if( key == '.' ) // Right
-            {
-                param->shear.x += param->inc;
-            }
-            // Rotation
-            else if( key == 'r' ) // Counter-Clockwise
-            {
-                param->rotate += param->inc;
-                param->rotate = (param->rotate >= 360) ? param->rotate - 360 : param->rotate;
-            }
-            else if( key == 'R' ) // Clockwise
-            {
-                param->rotate -= param->inc;
-                param->rotate = (param->rotate < 0) ? 360 + param->rotate : param->rotate;
-            }
-            else if( key == 'e' ) // Expand
-            {
-                param->circle.width += param->inc;
-            }
-            else if( key == 'E' ) // Shrink
-            {
-                param->circle.width -= param->inc;
-            }
-
-            if( param->img_src )
-            {
-                param->rect = cvShowImageAndWatershed( param->w_name, param->img_display, param->circle );
-                cvShowCroppedImage( param->miniw_name, param->img_src,
-                                    cvRect32fFromRect( param->rect, param->rotate ),
-                                    cvPointTo32f( param->shear ) );
-            }
+            param->circle.x += param->inc;
         }
-        else
+        // Rectangle Resize
+        else if( key == 'y' ) // Shrink width
         {
-            // Rectangle Movement (Vi like hotkeys)
-            if( key == 'h' ) // Left
-            {
-                param->rect.x -= param->inc;
-            }
-            else if( key == 'j' ) // Down
-            {
-                param->rect.y += param->inc;
-            }
-            else if( key == 'k' ) // Up
-            {
-                param->rect.y -= param->inc;
-            }
-            else if( key == 'l' ) // Right
-            {
-                param->rect.x += param->inc;
-            }
-            // Rectangle Resize
-            else if( key == 'y' ) // Shrink width
-            {
-                param->rect.width = max( 0, param->rect.width - param->inc );
-            }
-            else if( key == 'u' ) // Expand height
-            {
-                param->rect.height += param->inc;
-            }
-            else if( key == 'i' ) // Shrink height
-            {
-                param->rect.height = max( 0, param->rect.height - param->inc );
-            }
-            else if( key == 'o' ) // Expand width
-            {
-                param->rect.width += param->inc;
-            }
-            // Shear Deformation
-            else if( key == 'n' ) // Left
-            {
-                param->shear.x -= param->inc;
-            }
-            else if( key == 'm' ) // Down
-            {
-                param->shear.y += param->inc;
-            }
-            else if( key == ',' ) // Up
-            {
-                param->shear.y -= param->inc;
-            }
-            else if( key == '.' ) // Right
-            {
-                param->shear.x += param->inc;
-            }
-            // Rotation
-            else if( key == 'r' ) // Counter-Clockwise
-            {
-                param->rotate += param->inc;
-                param->rotate = (param->rotate >= 360) ? param->rotate - 360 : param->rotate;
-            }
-            else if( key == 'R' ) // Clockwise
-            {
-                param->rotate -= param->inc;
-                param->rotate = (param->rotate < 0) ? 360 + param->rotate : param->rotate;
-            }
-            else if( key == 'e' ) // Expand
-            {
-                param->rect.x = max( 0, param->rect.x - param->inc );
-                param->rect.width += 2 * param->inc;
-                param->rect.y = max( 0, param->rect.y - param->inc );
-                param->rect.height += 2 * param->inc;
-            }
-            else if( key == 'E' ) // Shrink
-            {
-                param->rect.x = min( param->img_src->width, param->rect.x + param->inc );
-                param->rect.width = max( 0, param->rect.width - 2 * param->inc );
-                param->rect.y = min( param->img_src->height, param->rect.y + param->inc );
-                param->rect.height = max( 0, param->rect.height - 2 * param->inc );
-            }
-            /*
-              if( key == 'e' || key == 'E' ) // Expansion and Shrink so that ratio does not change
-              {
-              if( param->rect.height != 0 && param->rect.width != 0 )
-              {
-              int gcd, a = param->rect.width, b = param->rect.height;
-              while( 1 )
-              {
-              a = a % b;
-              if( a == 0 ) { gcd = b; break; }
-              b = b % a;
-              if( b == 0 ) { gcd = a; break; }
-              }
-              int ratio_width = param->rect.width / gcd;
-              int ratio_height = param->rect.height / gcd;
-              if( key == 'e' ) gcd += param->inc;
-              else if( key == 'E' ) gcd -= param->inc;
-              if( gcd > 0 )
-              {
-              cout << ratio_width << ":" << ratio_height << " * " << gcd << endl;
-              param->rect.width = ratio_width * gcd;
-              param->rect.height = ratio_height * gcd;
-              cvShowImageAndRectangle( param->w_name, param->img,
-              cvRect32fFromRect( param->rect, param->rotate ),
-              cvPointTo32f( param->shear ) );
-              }
-              }
-              }*/
-
-            if( param->img_src )
-            {
-                cvShowImageAndRectangle( param->w_name, param->img_display,
-                                         cvRect32fFromRect( param->rect, param->rotate ),
-                                         cvPointTo32f( param->shear ) );
-                cvShowCroppedImage( param->miniw_name, param->img_src,
-                                    cvRect32fFromRect( param->rect, param->rotate ),
-                                    cvPointTo32f( param->shear ) );
-            }
+            param->circle.width -= param->inc;
+        }
+        else if( key == 'u' ) // Expand height
+        {
+            param->circle.width += param->inc;
+        }
+        else if( key == 'i' ) // Shrink height
+        {
+            param->circle.width -= param->inc;
+        }
+        else if( key == 'o' ) // Expand width
+        {
+            param->circle.width += param->inc;
+        }
+        // Shear Deformation
+        else if( key == 'n' ) // Left
+        {
+            param->shear.x -= param->inc;
+        }
+        else if( key == 'm' ) // Down
+        {
+            param->shear.y += param->inc;
+        }
+        else if( key == ',' ) // Up
+        {
+            param->shear.y -= param->inc;
+        }
+        else if( key == '.' ) // Right
+        {
+            param->shear.x += param->inc;
+        }
+        // Rotation
+        else if( key == 'r' ) // Counter-Clockwise
+        {
+            param->rotate += param->inc;
+            param->rotate = (param->rotate >= 360) ? param->rotate - 360 : param->rotate;
         }
+        else if( key == 'R' ) // Clockwise
+        {
+            param->rotate -= param->inc;
+            param->rotate = (param->rotate < 0) ? 360 + param->rotate : param->rotate;
+        }
+        else if( key == 'e' ) // Expand
+        {
+            param->circle.width += param->inc;
+        }
+        else if( key == 'E' ) // Shrink
+        {
+            param->circle.width -= param->inc;
+        }
+    }
+    else
+    {
+        // Rectangle Movement (Vi like hotkeys)
+        if( key == 'h' ) // Left
+        {
+            param->rect.x -= param->inc;
+        }
+        else if( key == 'j' ) // Down
+        {
+            param->rect.y += param->inc;
+        }
+        else if( key == 'k' ) // Up
+        {
+            param->rect.y -= param->inc;
+        }
+        else if( key == 'l' ) // Right
+        {
+            param->rect.x += param->inc;
+        }
+        // Rectangle Resize
+        else if( key == 'y' ) // Shrink width
+        {
+            param->rect.width = max( 0, param->rect.width - param->inc );
+        }
+        else if( key == 'u' ) // Expand height
+        {
+            param->rect.height += param->inc;
+        }
+        else if( key == 'i' ) // Shrink height
+        {
+            param->rect.height = max( 0, param->rect.height - param->inc );
+        }
+        else if( key == 'o' ) // Expand width
+        {
+            param->rect.width += param->inc;
+        }
+        // Shear Deformation
+        else if( key == 'n' ) // Left
+        {
+            param->shear.x -= param->inc;
+        }
+        else if( key == 'm' ) // Down
+        {
+            param->shear.y += param->inc;
+        }
+        else if( key == ',' ) // Up
+        {
+            param->shear.y -= param->inc;
+        }
+        else if( key == '.' ) // Right
+        {
+            param->shear.x += param->inc;
+        }
+        // Rotation
+        else if( key == 'r' ) // Counter-Clockwise
+        {
+            param->rotate += param->inc;
+            param->rotate = (param->rotate >= 360) ? param->rotate - 360 : param->rotate;
+        }
+        else if( key == 'R' ) // Clockwise
+        {
+            param->rotate -= param->inc;
+            param->rotate = (param->rotate < 0) ? 360 + param->rotate : param->rotate;
+        }
+        else if( key == 'e' ) // Expand
+        {
+            param->rect.x = max( 0, param->rect.x - param->inc );
+            param->rect.width += 2 * param->inc;
+            param->rect.y = max( 0, param->rect.y - param->inc );
+            param->rect.height += 2 * param->inc;
+        }
+        else if( key == 'E' ) // Shrink
+        {
+            param->rect.x = min( param->pyramid->size.width, param->rect.x + param->inc );
+            param->rect.width = max( 0, param->rect.width - 2 * param->inc );
+            param->rect.y = min( param->pyramid->size.height, param->rect.y + param->inc );
+            param->rect.height = max( 0, param->rect.height - 2 * param->inc );
+        }
+        /*
+          if( key == 'e' || key == 'E' ) // Expansion and Shrink so that ratio does not change
+          {
+          if( param->rect.height != 0 && param->rect.width != 0 )
+          {
+          int gcd, a = param->rect.width, b = param->rect.height;
+          while( 1 )
+          {
+          a = a % b;
+          if( a == 0 ) { gcd = b; break; }
+          b = b % a;
+          if( b == 0 ) { gcd = a; break; }
+          }
+          int ratio_width = param->rect.width / gcd;
+          int ratio_height = param->rect.height / gcd;
+          if( key == 'e' ) gcd += param->inc;
+          else if( key == 'E' ) gcd -= param->inc;
+          if( gcd > 0 )
+          {
+          cout << ratio_width << ":" << ratio_height << " * " << gcd << endl;
+          param->rect.width = ratio_width * gcd;
+          param->rect.height = ratio_height * gcd;
+          cvShowImageAndRectangle( param->w_name, param->img,
+          cvRect32fFromRect( param->rect, param->rotate ),
+          cvPointTo32f( param->shear ) );
+          }
+          }
+          }*/
+    }
+    param->redraw = true;
+    return true;
+}
+
+/**
+ * Show an image of the filelist
+ *
+ * @param [display = true] Resample the display image. false when another
+ *                         image is shown right after, e.g., on key repeat.
+ * @return false if the file is not loadable
+ */
+bool show_file( CvCallbackParam* param, long index, bool display )
+{
+    IplImage* img_src;
+    IcPyramid* pyramid;
+    float scale_factor;
+    if( !icPrefetchGet( param->prefetch, index, &img_src, &pyramid, &scale_factor ) )
+    {
+        cerr << "The image file " << fs::realpath( param->filelist[index] ) << " is not loadable. Skipped." << endl;
+        return false;
     }
+    param->img_src = img_src;
+    param->pyramid = pyramid;
+    param->scale_factor = scale_factor;
+    param->fileiter = param->filelist.begin() + index;
+    param->tiled = icPrefetchTiled( param->prefetch, index );
+    param->view.rect = cvRect( 0, 0, 0, 0 );
+    param->parts = icCatalogSplitPath( param->catalog, *param->fileiter );
+    if( display )
+    {
+        update_display( param );
+    }
+    else
+    {
+        // the previous display image may belong to an evicted pyramid
+        if( param->own_display ) cvReleaseImage( &param->img_display );
+        param->img_display = NULL;
+        param->own_display = false;
+    }
+    return true;
+}
+
+/**
+ * Move step images forward (step > 0) or backward (step < 0) at once.
+ * Only the image landed on is decoded. Unloadable files are skipped further
+ * in the direction, then back toward the current image.
+ *
+ * @return false if no loadable image is left in the direction
+ */
+bool step_filelist( CvCallbackParam* param, int step, bool display )
+{
+    long current = param->fileiter - param->filelist.begin();
+    long last = (long)param->filelist.size() - 1, dir = step > 0 ? 1 : -1;
+    long target = min( max( current + step, 0L ), last );
+    if( target == current ) return false;
+    for( long index = target; 0 <= index && index <= last; index += dir )
+    {
+        if( show_file( param, index, display ) ) return true;
+    }
+    for( long index = target - dir; index != current; index -= dir )
+    {
+        if( show_file( param, index, display ) ) return true;
+    }
+    return false;
+}
+
+/**
+ * Set a new video frame and fit it into the screen
+ *
+ * @param frame The frame owned by param->frame_buffer
+ */
+void load_frame( CvCallbackParam* param, IplImage* frame )
+{
+    param->img_src = frame;
+    icReleasePyramid( &param->pyramid );
+    param->pyramid = icCreatePyramid( param->img_src, param->screen_size );
+    param->scale_factor = icFitScale( cvGetSize( param->img_src ), param->screen_size );
+    param->view.rect = cvRect( 0, 0, 0, 0 );
+    update_display( param );
+}
+
+/**
+ * Take the files found by the directory scan since the last call.
+ * The current file stays current.
+ */
+void update_filelist( CvCallbackParam* param )
+{
+    if( param->dirscan == NULL ) return;
+    vector<string> filelist;
+    if( icDirScanTake( param->dirscan, filelist ) )
+    {
+        string current = *param->fileiter;
+        vector<string>::iterator iter = lower_bound( filelist.begin(), filelist.end(), current );
+        if( iter == filelist.end() || *iter != current ) filelist.insert( iter, current );
+        icPrefetchSwapList( param->prefetch, filelist );
+        param->fileiter = lower_bound( param->filelist.begin(), param->filelist.end(), current );
+    }
+    if( icDirScanFinished( param->dirscan ) )
+    {
+        param->catalog = icDirScanTakeCatalog( param->dirscan );
+        icReleaseDirScan( &param->dirscan );
+        cerr << param->filelist.size() << " images in the directory." << endl;
+    }
+}
+
+/**
+ * Resample the viewport of param->img_display from the display pyramid at param->scale_factor
+ */
+void update_display( CvCallbackParam* param )
+{
+    if( param->own_display ) cvReleaseImage( &param->img_display );
+    icViewportClamp( &param->view, param->pyramid->size, param->scale_factor );
+    if( param->tiled && param->scale_factor * ( 1 << param->pyramid->base ) > 1.0f )
+    {
+        // finer than the overview
+        param->img_display = icTiledRender( param->tiled, param->view.rect, param->scale_factor );
+        param->own_display = true;
+    }
+    else
+    {
+        param->img_display = icPyramidRender( param->pyramid, param->scale_factor, param->view.rect,
+                                              &param->own_display, param->img_src );
+    }
+    icSurfaceInvalidate( param->surface );
+    param->redraw = true;
+    param->resample = false;
+}
+
+/**
+ * Get param->img_src when the current image is decoded at a reduced size
+ *
+ * The full resolution image is requested only when a crop needs it or the
+ * zoom goes beyond the reduced size.
+ *
+ * @param wait Decode it now for a save
+ * @return false if param->img_src is not available
+ */
+bool update_source( CvCallbackParam* param, bool wait )
+{
+    if( param->img_src || param->cap || param->tiled ) return param->img_src != NULL;
+    bool crop = param->rect.width > 0 && param->rect.height > 0;
+    bool zoom = param->scale_factor * ( 1 << param->pyramid->base ) > 1.0f;
+    if( !wait && !crop && !zoom ) return false;
+    param->img_src = icPrefetchSource( param->prefetch, param->fileiter - param->filelist.begin(), wait );
+    if( param->img_src == NULL ) return false;
+    if( zoom ) update_display( param );
+    param->redraw = true;
+    return true;
 }
 
 /**
@@ -779,13 +1013,43 @@ void mouse_callback( int event, int x, int y, int flags, void* _param )
     static bool resize_rect_bottom = false;
     static bool move_watershed     = false;
     static bool resize_watershed   = false;
+    static bool pan_view           = false;
+    static CvPoint pan0            = cvPoint( 0, 0 );
 
-    if( !param->img_src || !param->img_display )
+    if( !param->img_display )
         return;
 
     if( x >= 32768 ) x -= 65536; // change left outsite to negative
     if( y >= 32768 ) y -= 65536; // change top outside to negative
 
+    // LBUTTON + CTRL is to pan the view. In window coordinates.
+    if( event == CV_EVENT_LBUTTONDOWN && flags & CV_EVENT_FLAG_CTRLKEY )
+    {
+        pan_view = true;
+        pan0 = cvPoint( x, y );
+        return;
+    }
+    else if( pan_view )
+    {
+        if( event == CV_EVENT_MOUSEMOVE && flags & CV_EVENT_FLAG_LBUTTON )
+        {
+            icViewportPan( &param->view, param->pyramid->size, param->scale_factor, pan0.x - x, pan0.y - y );
+            pan0 = cvPoint( x, y );
+            // resampled once on rendering however many moves come in between
+            param->resample = true;
+            param->redraw = true;
+        }
+        else if( event == CV_EVENT_LBUTTONUP )
+        {
+            pan_view = false;
+        }
+        return;
+    }
+
+    // to display coordinates
+    x += param->view.rect.x;
+    y += param->view.rect.y;
+
     // MBUTTON or LBUTTON + SHIFT is to draw wathershed
     if( event == CV_EVENT_MBUTTONDOWN ||
             ( event == CV_EVENT_LBUTTONDOWN && flags & CV_EVENT_FLAG_SHIFTKEY ) ) // initialization
@@ -801,10 +1065,7 @@ void mouse_callback( int event, int x, int y, int flags, void* _param )
         param->shear.x = param->shear.y = 0;
 
         param->circle.width = (int) cvPointNorm( cvPoint( param->circle.x, param->circle.y ), cvPoint( x, y ) );
-        param->rect = cvShowImageAndWatershed( param->w_name, param->img_display, param->circle );
-        cvShowCroppedImage( param->miniw_name, param->img_src,
-                            cvRect32fFromRect( param->rect, param->rotate ),
-                            cvPointTo32f( param->shear ) );
+        param->redraw = true;
     }
 
     // LBUTTON is to draw rectangle
@@ -822,13 +1083,8 @@ void mouse_callback( int event, int x, int y, int flags, void* _param )
         param->rect.y = min( point0.y, y );
         param->rect.width =  abs( point0.x - x );
         param->rect.height = abs( point0.y - y );
+        param->redraw = true;
 
-        cvShowImageAndRectangle( param->w_name, param->img_display,
-                                         cvRect32fFromRect( param->rect, param->rotate ),
-                                         cvPointTo32f( param->shear ) );
-        cvShowCroppedImage( param->miniw_name, param->img_src,
-                            cvRect32f( param->rect.x*(1/param->scale_factor), param->rect.y*(1/param->scale_factor), param->rect.width*(1/param->scale_factor), param->rect.height*(1/param->scale_factor), param->rotate ),
-                            cvPointTo32f( param->shear ) );
 //        cvShowImageAndRectangle( param->w_name, param->img_display,
 //                                 cvRect32fFromRect( param->rect, param->rotate ),
 //                                 cvPointTo32f( param->shear ) );
@@ -889,21 +1145,14 @@ void mouse_callback( int event, int x, int y, int flags, void* _param )
             CvPoint move = cvPoint( x - point0.x, y - point0.y );
             param->circle.x += move.x;
             param->circle.y += move.y;
-
-            param->rect = cvShowImageAndWatershed( param->w_name, param->img_display, param->circle );
-            cvShowCroppedImage( param->miniw_name, param->img_src,
-                                cvRect32fFromRect( param->rect, param->rotate ),
-                                cvPointTo32f( param->shear ) );
+            param->redraw = true;
 
             point0 = cvPoint( x, y );
         }
         else if( resize_watershed )
         {
             param->circle.width = (int) cvPointNorm( cvPoint( param->circle.x, param->circle.y ), cvPoint( x, y ) );
-            param->rect = cvShowImageAndWatershed( param->w_name, param->img_display, param->circle );
-            cvShowCroppedImage( param->miniw_name, param->img_src,
-                                cvRect32fFromRect( param->rect, param->rotate ),
-                                cvPointTo32f( param->shear ) );
+            param->redraw = true;
         }
     }
     else if( event == CV_EVENT_MOUSEMOVE && flags & CV_EVENT_FLAG_RBUTTON ) // Move or resize for rectangle
@@ -956,12 +1205,7 @@ void mouse_callback( int event, int x, int y, int flags, void* _param )
             resize_rect_bottom = tmp;
         }
 
-        cvShowImageAndRectangle( param->w_name, param->img_display,
-                                 cvRect32fFromRect( param->rect, param->rotate ),
-                                 cvPointTo32f( param->shear ) );
-        cvShowCroppedImage( param->miniw_name, param->img_src,
-                            cvRect32fFromRect( param->rect, param->rotate ),
-                            cvPointTo32f( param->shear ) );
+        param->redraw = true;
         point0 = cvPoint( x, y );
     }
 
@@ -1007,6 +1251,66 @@ void arg_parse( int argc, char** argv, ArgParam *arg )
         {
             arg->frame = atoi( argv[++i] );
         }
+        else if( !strcmp( argv[i], "-b" ) || !strcmp( argv[i], "--batch" ) )
+        {
+            arg->batch = argv[++i];
+        }
+        else if( !strcmp( argv[i], "-n" ) || !strcmp( argv[i], "--dry_run" ) )
+        {
+            arg->dry_run = true;
+        }
+        else if( !strcmp( argv[i], "-j" ) || !strcmp( argv[i], "--jobs" ) )
+        {
+            arg->jobs = atoi( argv[++i] );
+        }
+        else if( !strcmp( argv[i], "--ahead" ) )
+        {
+            arg->ahead = atoi( argv[++i] );
+        }
+        else if( !strcmp( argv[i], "--behind" ) )
+        {
+            arg->behind = atoi( argv[++i] );
+        }
+        else if( !strcmp( argv[i], "--cache" ) )
+        {
+            arg->cache_mb = atoi( argv[++i] );
+        }
+        else if( !strcmp( argv[i], "--file_cache" ) )
+        {
+            arg->file_cache_mb = atoi( argv[++i] );
+        }
+        else if( !strcmp( argv[i], "--save_queue" ) )
+        {
+            arg->save_queue = atoi( argv[++i] );
+        }
+        else if( !strcmp( argv[i], "--frame_buffer" ) )
+        {
+            arg->frame_buffer_mb = atoi( argv[++i] );
+        }
+        else if( !strcmp( argv[i], "--refresh" ) )
+        {
+            arg->refresh = atoi( argv[++i] );
+        }
+        else if( !strcmp( argv[i], "-r" ) || !strcmp( argv[i], "--recursive" ) )
+        {
+            arg->recursive = true;
+        }
+        else if( !strcmp( argv[i], "--interpolation" ) )
+        {
+            const char* name = argv[++i];
+            if( !strcmp( name, "linear" ) ) arg->interpolation = CV_INTER_LINEAR;
+            else if( !strcmp( name, "cubic" ) ) arg->interpolation = CV_INTER_CUBIC;
+            else if( !strcmp( name, "nn" ) ) arg->interpolation = CV_INTER_NN;
+            else cerr << "The interpolation " << name << " is not supported." << endl;
+        }
+        else if( !strcmp( argv[i], "--include" ) )
+        {
+            arg->include.push_back( argv[++i] );
+        }
+        else if( !strcmp( argv[i], "--exclude" ) )
+        {
+            arg->exclude.push_back( argv[++i] );
+        }
         else
         {
             arg->reference = string( argv[i] );
@@ -1027,6 +1331,7 @@ void usage( const ArgParam* arg )
     cout << "    For a directory, image files in the directory will be read sequentially." << endl;
     cout << "    For an image, it starts to read a directory from the specified image file. " << endl;
     cout << "    (A file is judged as an image based on its filename extension.)" << endl;
+    cout << "    Image files of a directory are cataloged under ~/.cache/imageclipper for fast reopening." << endl;
     cout << "    A file except images is tried to be read as a video and read frame by frame. " << endl;
     cout << endl;
     cout << "  Options" << endl;
@@ -1054,6 +1359,45 @@ void usage( const ArgParam* arg )
     cout << "    -f" << endl;
     cout << "    --frame <frame = 1> (video)" << endl;
     cout << "        Determine the frame number of video to start to read." << endl;
+    cout << "        Keyframes of a video are indexed once into <video>.icindex for fast seeking." << endl;
+    cout << "    --frame_buffer <frame_buffer = " << arg->frame_buffer_mb << "> (video)" << endl;
+    cout << "        Determine the memory cap of decoded frames in MB." << endl;
+    cout << "        Stepping backward decodes the preceding GOP once and steps in memory." << endl;
+    cout << "    -b" << endl;
+    cout << "    --batch <manifest>" << endl;
+    cout << "        Write all crops listed in a manifest without GUI." << endl;
+    cout << "        One crop per line: path frame x y width height [rotate [shear_x [shear_y]]]" << endl;
+    cout << "        Each image or video frame is decoded once." << endl;
+    cout << "    -n" << endl;
+    cout << "    --dry_run (batch)" << endl;
+    cout << "        Only check that sources exist and crops lie within images, reading image headers." << endl;
+    cout << "    --interpolation <interpolation = nn>" << endl;
+    cout << "        Determine the sampling of rotated and sheared crops: nn, linear or cubic." << endl;
+    cout << "        linear and cubic give smooth edges at a higher cost." << endl;
+    cout << "    -r" << endl;
+    cout << "    --recursive (directory)" << endl;
+    cout << "        Read subdirectories too. Images of all subdirectories are navigated in one sorted order." << endl;
+    cout << "    --include <glob> (directory)" << endl;
+    cout << "    --exclude <glob> (directory)" << endl;
+    cout << "        Read only files matching, or skip files and directories matching a glob." << endl;
+    cout << "        Globs are relative to the directory. * and ? do not match /, ** does." << endl;
+    cout << "        A glob without / is matched against filenames. Both may be given multiple times." << endl;
+    cout << "    -j" << endl;
+    cout << "    --jobs <jobs = number of cores (batch), 16 (recursive)>" << endl;
+    cout << "        Determine the number of worker threads for --batch," << endl;
+    cout << "        or the number of directories read at once for --recursive." << endl;
+    cout << "    --ahead <ahead = " << arg->ahead << "> (directory)" << endl;
+    cout << "    --behind <behind = " << arg->behind << "> (directory)" << endl;
+    cout << "        Determine the number of next and previous images decoded in background." << endl;
+    cout << "    --cache <cache = " << arg->cache_mb << "> (directory)" << endl;
+    cout << "        Determine the memory ceiling of decoded images in MB." << endl;
+    cout << "    --file_cache <file_cache = " << arg->file_cache_mb << "> (directory)" << endl;
+    cout << "        Determine the memory ceiling of image files read ahead in MB." << endl;
+    cout << "    --save_queue <save_queue = " << arg->save_queue << ">" << endl;
+    cout << "        Determine the number of crops which may wait to be written in background." << endl;
+    cout << "    --refresh <refresh = " << arg->refresh << ">" << endl;
+    cout << "        Determine the maximum number of redraws per second." << endl;
+    cout << "        Mouse and key events arriving faster are folded into the next redraw." << endl;
     cout << "    -h" << endl;
     cout << "    --help" << endl;
     cout << "        Show this help" << endl;
@@ -1085,5 +1429,6 @@ void gui_usage()
     cout << "    h (left) j (down) k (up) l (right) : Move rectangle. (vi-like keybinds)" << endl;
     cout << "    y (left) u (down) i (up) o (right) : Resize rectangle. (Move boundaries)" << endl;
     cout << "    n (left) m (down) , (up) . (right) : Shear deformation." << endl;
+    cout << "    H (left) J (down) K (up) L (right) : Pan the view. Or drag with CTRL + Left." << endl;
 }
 
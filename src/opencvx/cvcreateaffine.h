@@ -35,6 +35,7 @@
 CVAPI(void) cvCreateAffine( CvMat* affine, 
                             CvRect32f rect = cvRect32f(0,0,1,1,0), 
                             CvPoint2D32f shear = cvPoint2D32f(0,0) );
+CV_INLINE void icvCreatePixelAffine( double A[6], CvRect32f rect, CvPoint2D32f shear );
 
 /**
  * Create an affine transform matrix
@@ -96,5 +97,26 @@ CVAPI(void) cvCreateAffine( CvMat* affine, CvRect32f rect, CvPoint2D32f shear )
     __END__;
 }
 
+/**
+ * Create the affine of cvCreateAffine as plain scalars, scaled to pixels
+ *
+ * cvCreateAffine maps the unit square. This maps the pixel (x, y) of a
+ * rect.width x rect.height patch to the point
+ * ( A[0] x + A[1] y + A[2], A[3] x + A[4] y + A[5] ).
+ *
+ * @param A         The 2 x 3 affine to be created, row major
+ * @param rect      The translation, scaling and rotation as cvCreateAffine
+ * @param shear     The shear deformation parameter shx and shy
+ * @return void
+ * @uses cvCreateAffine
+ */
+CV_INLINE void icvCreatePixelAffine( double A[6], CvRect32f rect, CvPoint2D32f shear )
+{
+    CvMat affine = cvMat( 2, 3, CV_64FC1, A );
+    cvCreateAffine( &affine, rect, shear );
+    A[0] /= rect.width; A[1] /= rect.height;
+    A[3] /= rect.width; A[4] /= rect.height;
+}
+
 
 #endif
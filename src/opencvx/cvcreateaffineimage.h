@@ -32,12 +32,14 @@
 #include <limits.h>
 
 #include "cvinvaffine.h"
+#include "cvwarpaffinerows.h"
 
 #define CV_AFFINE_SAME 0
 #define CV_AFFINE_FULL 1
 CVAPI(IplImage*) cvCreateAffineImage( const IplImage* src, const CvMat* affine, 
                                 int flags = CV_AFFINE_SAME, CvPoint* origin = NULL,
-                                CvScalar color = CV_RGB(0,0,0) );
+                                CvScalar color = CV_RGB(0,0,0),
+                                int interpolation = CV_INTER_NN );
 CV_INLINE IplImage* cvCreateAffineMask( const IplImage* src, const CvMat* affine, 
                                         int flags = CV_AFFINE_SAME, CvPoint* origin = NULL );
 
@@ -74,26 +76,29 @@ CV_INLINE IplImage* cvCreateAffineMask( const IplImage* src, const CvMat* affine
  * @param origin    The coordinate of origin (the coordinate in original image respective to 
  *                  the transformed image origin). 
  *                  Useful when CV_AFFINE_FULL is used.
+ * @param color     The color outside of the original image
+ * @param interpolation CV_INTER_NN, CV_INTER_LINEAR or CV_INTER_CUBIC
  * @return IplImage*
  * @see cvWarpAffine - this does not support CV_AFFINE_FULL, but supports
  *                     several interpolation methods and so on.
+ * @uses icvWarpAffineRows
  */
 CVAPI(IplImage*) cvCreateAffineImage( const IplImage* src, const CvMat* affine, 
                                 int flags, CvPoint* origin,
-                                CvScalar color )
+                                CvScalar color, int interpolation )
 {
     IplImage* dst;
     int minx = INT_MAX;
     int miny = INT_MAX;
     int maxx = INT_MIN;
     int maxy = INT_MIN;
-    int i, x, y, xx, yy, xp, yp;
-    int ch, width, height;
+    int i, x, y;
+    int width, height;
     CvPoint pt[4];
     CvMat* invaffine;
+    double A[6];
     CV_FUNCNAME( "cvAffineImage" );
     __BEGIN__;
-    CV_ASSERT( src->depth == IPL_DEPTH_8U );
     CV_ASSERT( affine->rows == 2 && affine->cols == 3 );
 
     // cvBoxPoints supports only rotation (no shear deform)
@@ -149,27 +154,12 @@ CVAPI(IplImage*) cvCreateAffineImage( const IplImage* src, const CvMat* affine,
     invaffine = cvCreateMat( 2, 3, affine->type );
     cvInvAffine( affine, invaffine );
     
-    // loop based on image coordinates of transformed image
-    for( x = 0; x < width; x++ )
-    {
-        xx = x + minx;
-        for( y = 0; y < height; y++ )
-        {
-            yy = y + miny;
-            xp = cvRound( xx * cvmGet( invaffine, 0, 0 ) + 
-                              yy * cvmGet( invaffine, 0, 1 ) + 
-                              cvmGet( invaffine, 0, 2 ) );
-            yp = cvRound( xx * cvmGet( invaffine, 1, 0 ) + 
-                              yy * cvmGet( invaffine, 1, 1 ) + 
-                              cvmGet( invaffine, 1, 2 ) );
-            if( xp < 0 || xp >= src->width || yp < 0 || yp >= src->height ) continue;
-            for( ch = 0; ch < src->nChannels; ch++ )
-            {
-                dst->imageData[dst->widthStep * y + x * dst->nChannels + ch]
-                    = src->imageData[src->widthStep * yp + xp * src->nChannels + ch];
-            }
-        }
-    }
+    // the inverse affine from image coordinates of transformed image
+    A[0] = cvmGet( invaffine, 0, 0 ); A[1] = cvmGet( invaffine, 0, 1 );
+    A[3] = cvmGet( invaffine, 1, 0 ); A[4] = cvmGet( invaffine, 1, 1 );
+    A[2] = cvmGet( invaffine, 0, 2 ) + A[0] * minx + A[1] * miny;
+    A[5] = cvmGet( invaffine, 1, 2 ) + A[3] * minx + A[4] * miny;
+    icvWarpAffineRows( src, dst, A, interpolation );
     cvReleaseMat( &invaffine );
     __END__;
     return dst;
@@ -32,10 +32,12 @@
 
 #include "cvcreateaffine.h"
 #include "cvrect32f.h"
+#include "cvwarpaffinerows.h"
 
 CVAPI(void) cvCropImageROI( const IplImage* img, IplImage* dst, 
                             CvRect32f rect32f = cvRect32f(0,0,1,1,0),
-                            CvPoint2D32f shear = cvPoint2D32f(0,0) );
+                            CvPoint2D32f shear = cvPoint2D32f(0,0),
+                            int interpolation = CV_INTER_NN );
 CVAPI(void) cvShowCroppedImage( const char* w_name, IplImage* orig, 
                             CvRect32f rect32f = cvRect32f(0,0,1,1,0),
                             CvPoint2D32f shear = cvPoint2D32f(0,0) );
@@ -54,12 +56,18 @@ CVAPI(void) cvShowCroppedImage( const char* w_name, IplImage* orig,
  *                     the rotation angle in degree where the rotation center is (x,y)
  * @param [shear = cvPoint2D32f(0,0)]
  *                     The shear deformation parameter shx and shy
+ * @param [interpolation = CV_INTER_NN]
+ *                     CV_INTER_NN, CV_INTER_LINEAR or CV_INTER_CUBIC for
+ *                     rotated or sheared rectangles
  * @return void
+ * @uses icvWarpAffineRows
  */
-CVAPI(void) cvCropImageROI( const IplImage* img, IplImage* dst, CvRect32f rect32f, CvPoint2D32f shear )
+CVAPI(void) cvCropImageROI( const IplImage* img, IplImage* dst, CvRect32f rect32f, CvPoint2D32f shear,
+                            int interpolation )
 {
     CvRect rect = cvRectFromRect32f( rect32f );
     float angle = rect32f.angle;
+    uchar zero[32] = { 0 };
     CV_FUNCNAME( "cvCropImageROI" );
     __BEGIN__;
     CV_ASSERT( rect.width > 0 && rect.height > 0 );
@@ -76,61 +84,16 @@ CVAPI(void) cvCropImageROI( const IplImage* img, IplImage* dst, CvRect32f rect32
     }
     else if( shear.x == 0 && shear.y == 0 )
     {
-        int x, y, ch, xp, yp;
         double c = cos( -M_PI / 180 * angle );
         double s = sin( -M_PI / 180 * angle );
-        /*CvMat* R = cvCreateMat( 2, 3, CV_32FC1 );
-        cv2DRotationMatrix( cvPoint2D32f( 0, 0 ), angle, 1.0, R );
-        double c = cvmGet( R, 0, 0 );
-        double s = cvmGet( R, 1, 0 );
-        cvReleaseMat( &R );*/
-        cvZero( dst );
-
-        for( x = 0; x < rect.width; x++ )
-        {
-            for( y = 0; y < rect.height; y++ )
-            {
-                xp = cvRound( c * x + -s * y ) + rect.x;
-                yp = cvRound( s * x + c * y ) + rect.y;
-                if( xp < 0 || xp >= img->width || yp < 0 || yp >= img->height ) continue;
-                for( ch = 0; ch < img->nChannels; ch++ )
-                {
-                    dst->imageData[dst->widthStep * y + x * dst->nChannels + ch]
-                        = img->imageData[img->widthStep * yp + xp * img->nChannels + ch];
-                }
-            }
-        }
+        double A[6] = { c, -s, (double)rect.x, s, c, (double)rect.y };
+        icvWarpAffineRows( img, dst, A, interpolation, zero );
     }
     else
     {
-        int x, y, ch, xp, yp;
-        CvMat* affine = cvCreateMat( 2, 3, CV_32FC1 );
-        CvMat* xy     = cvCreateMat( 3, 1, CV_32FC1 );
-        CvMat* xyp    = cvCreateMat( 2, 1, CV_32FC1 );
-        cvCreateAffine( affine, rect32f, shear );
-        cvmSet( xy, 2, 0, 1.0 );
-        cvZero( dst );
-
-        for( x = 0; x < rect.width; x++ )
-        {
-            cvmSet( xy, 0, 0, x / rect32f.width );
-            for( y = 0; y < rect.height; y++ )
-            {
-                cvmSet( xy, 1, 0, y / rect32f.height );
-                cvMatMul( affine, xy, xyp );
-                xp = cvRound( cvmGet( xyp, 0, 0 ) );
-                yp = cvRound( cvmGet( xyp, 1, 0 ) );
-                if( xp < 0 || xp >= img->width || yp < 0 || yp >= img->height ) continue;
-                for( ch = 0; ch < img->nChannels; ch++ )
-                {
-                    dst->imageData[dst->widthStep * y + x * dst->nChannels + ch]
-                        = img->imageData[img->widthStep * yp + xp * img->nChannels + ch];
-                }
-            }
-        }
-        cvReleaseMat( &affine );
-        cvReleaseMat( &xy );
-        cvReleaseMat( &xyp );
+        double A[6];
+        icvCreatePixelAffine( A, rect32f, shear );
+        icvWarpAffineRows( img, dst, A, interpolation, zero );
     }
     __END__;
 }
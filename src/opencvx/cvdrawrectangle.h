@@ -29,8 +29,10 @@
 #include "cxcore.h"
 #define _USE_MATH_DEFINES
 #include <math.h>
+#include <string.h>
 
 #include "cvcreateaffine.h"
+#include "cvipltocvdepth.h"
 #include "cvrect32f.h"
 
 CVAPI(void) cvDrawRectangle( IplImage* img, 
@@ -47,6 +49,51 @@ CVAPI(void) cvShowImageAndRectangle( const char* w_name, const IplImage* img,
                                      int thickness = 1, int line_type = 8, 
                                      int shift = 0);
 
+/**
+ * Set the pixel of an image which a patch pixel is mapped to by an affine
+ *
+ * @param pixel The pixel value as stored in img, see cvScalarToRawData
+ */
+CV_INLINE void icvDrawAffinePixel( IplImage* img, const double A[6], int x, int y, const uchar* pixel )
+{
+    int pixsize = ( ( img->depth & 255 ) >> 3 ) * img->nChannels;
+    int xp = cvRound( A[0] * x + A[1] * y + A[2] );
+    int yp = cvRound( A[3] * x + A[4] * y + A[5] );
+    if( xp < 0 || xp >= img->width || yp < 0 || yp >= img->height ) return;
+    memcpy( img->imageData + img->widthStep * yp + xp * pixsize, pixel, pixsize );
+}
+
+/**
+ * Draw the border pixels of a width x height patch mapped by an affine
+ *
+ * @param img    The image to be drawn
+ * @param A      The 2 x 3 affine from patch to image coordinates, row major
+ * @param width  The patch width
+ * @param height The patch height
+ * @param color  The color
+ * @return void
+ */
+CV_INLINE void icvDrawAffineBorder( IplImage* img, const double A[6], int width, int height, CvScalar color )
+{
+    int x, y;
+    double pixel[4];
+    cvScalarToRawData( &color, pixel, CV_MAKETYPE( cvIplToCvDepth( img->depth ), img->nChannels ), 0 );
+    for( x = 0; x < width; x++ )
+    {
+        for( y = 0; y < height; y += MAX( 1, height - 1 ) )
+        {
+            icvDrawAffinePixel( img, A, x, y, (const uchar*)pixel );
+        }
+    }
+    for( y = 0; y < height; y++ )
+    {
+        for( x = 0; x < width; x += MAX( 1, width - 1 ) )
+        {
+            icvDrawAffinePixel( img, A, x, y, (const uchar*)pixel );
+        }
+    }
+}
+
 /**
  * Draw an rotated and sheared rectangle
  *
@@ -90,89 +137,21 @@ CVAPI(void) cvDrawRectangle( IplImage* img,
         CvPoint pt2 = cvPoint( rect.x + rect.width - 1, rect.y + rect.height - 1 );
         cvRectangle( img, pt1, pt2, color, thickness, line_type, shift );
     }
-    else if( shear.x == 0 && shear.y == 0 )
-    {
-        int x, y, ch, xp, yp;
-        double c = cos( -M_PI / 180 * angle );
-        double s = sin( -M_PI / 180 * angle );
-        /*CvMat* R = cvCreateMat( 2, 3, CV_32FC1 );
-        cv2DRotationMatrix( cvPoint2D32f( 0, 0 ), angle, 1.0, R );
-        double c = cvmGet( R, 0, 0 );
-        double s = cvmGet( R, 1, 0 );
-        cvReleaseMat( &R );*/
-
-        for( x = 0; x < rect.width; x++ )
-        {
-            for( y = 0; y < rect.height; y += max(1, rect.height - 1) )
-            {
-                xp = cvRound( c * x + -s * y ) + rect.x;
-                yp = cvRound( s * x + c * y ) + rect.y;
-                if( xp < 0 || xp >= img->width || yp < 0 || yp >= img->height ) continue;
-                for( ch = 0; ch < img->nChannels; ch++ )
-                {
-                    img->imageData[img->widthStep * yp + xp * img->nChannels + ch] = (char)color.val[ch];
-                }
-            }
-        }
-
-        for( y = 0; y < rect.height; y++ )
-        {
-            for( x = 0; x < rect.width; x += max( 1, rect.width - 1) )
-            {
-                xp = cvRound( c * x + -s * y ) + rect.x;
-                yp = cvRound( s * x + c * y ) + rect.y;
-                if( xp < 0 || xp >= img->width || yp < 0 || yp >= img->height ) continue;
-                for( ch = 0; ch < img->nChannels; ch++ )
-                {
-                    img->imageData[img->widthStep * yp + xp * img->nChannels + ch] = (char)color.val[ch];
-                }
-            }
-        }
-    }
     else
     {
-        int x, y, ch, xp, yp;
-        CvMat* affine = cvCreateMat( 2, 3, CV_32FC1 );
-        CvMat* xy     = cvCreateMat( 3, 1, CV_32FC1 );
-        CvMat* xyp    = cvCreateMat( 2, 1, CV_32FC1 );
-        cvmSet( xy, 2, 0, 1.0 );
-        cvCreateAffine( affine, rect32f, shear );
-
-        for( x = 0; x < rect.width; x++ )
+        double A[6];
+        if( shear.x == 0 && shear.y == 0 )
         {
-            cvmSet( xy, 0, 0, x / rect32f.width );
-            for( y = 0; y < rect.height; y += max(1, rect.height - 1) )
-            {
-                cvmSet( xy, 1, 0, y / rect32f.height );
-                cvMatMul( affine, xy, xyp );
-                xp = cvRound( cvmGet( xyp, 0, 0 ) );
-                yp = cvRound( cvmGet( xyp, 1, 0 ) );
-                if( xp < 0 || xp >= img->width || yp < 0 || yp >= img->height ) continue;
-                for( ch = 0; ch < img->nChannels; ch++ )
-                {
-                    img->imageData[img->widthStep * yp + xp * img->nChannels + ch] = (char)color.val[ch];
-                }
-            }
+            double c = cos( -M_PI / 180 * angle );
+            double s = sin( -M_PI / 180 * angle );
+            A[0] = c; A[1] = -s; A[2] = rect.x;
+            A[3] = s; A[4] = c;  A[5] = rect.y;
         }
-        for( y = 0; y < rect.height; y++ )
+        else
         {
-            cvmSet( xy, 1, 0, y / rect32f.height );
-            for( x = 0; x < rect.width; x += max( 1, rect.width - 1) )
-            {
-                cvmSet( xy, 0, 0, x / rect32f.width );
-                cvMatMul( affine, xy, xyp );
-                xp = cvRound( cvmGet( xyp, 0, 0 ) );
-                yp = cvRound( cvmGet( xyp, 1, 0 ) );
-                if( xp < 0 || xp >= img->width || yp < 0 || yp >= img->height ) continue;
-                for( ch = 0; ch < img->nChannels; ch++ )
-                {
-                    img->imageData[img->widthStep * yp + xp * img->nChannels + ch] = (char)color.val[ch];
-                }
-            }
+            icvCreatePixelAffine( A, rect32f, shear );
         }
-        cvReleaseMat( &affine );
-        cvReleaseMat( &xy );
-        cvReleaseMat( &xyp );
+        icvDrawAffineBorder( img, A, rect.width, rect.height, color );
     }
     __END__;
 }
@@ -0,0 +1,180 @@
+/** @file
+* The MIT License
+* 
+* Copyright (c) 2008, Naotoshi Seo <sonots(at)sonots.com>
+* 
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+* 
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+* 
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+#ifndef CV_PARALLELROWS_INCLUDED
+#define CV_PARALLELROWS_INCLUDED
+
+#include "cv.h"
+#include "cxcore.h"
+#include <algorithm>
+#include <functional>
+#ifdef HAVE_TBB
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
+#else
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#endif
+
+/** Images of fewer destination pixels are processed on the calling thread */
+#define ICV_PARALLEL_MIN_PIXELS ( 512 * 512 )
+/** Bands per thread, so that threads finishing early take more */
+#define ICV_PARALLEL_BANDS_PER_THREAD 4
+
+#ifndef HAVE_TBB
+/**
+ * Threads splitting the rows of one image at a time
+ */
+typedef struct IcvRowPool {
+    std::vector<std::thread> threads;
+    std::mutex busy;                   /**< held by the caller using the pool */
+    std::mutex lock;
+    std::condition_variable wake;      /**< signaled when bands are posted or on stop */
+    std::condition_variable done;      /**< signaled when the last band finishes */
+    const std::function<void( int, int )>* body;
+    int rows;
+    int bands;
+    int next;                          /**< next band to be taken */
+    int finished;                      /**< bands finished */
+    bool stop;
+} IcvRowPool;
+
+/**
+ * Take and process bands until none is left
+ *
+ * @param lk The locked pool lock. Unlocked while a band is processed.
+ */
+CV_INLINE void icvRowPoolRun( IcvRowPool* pool, std::unique_lock<std::mutex>& lk )
+{
+    while( pool->next < pool->bands )
+    {
+        int band = pool->next++;
+        lk.unlock();
+        (*pool->body)( (int)( (long long)band * pool->rows / pool->bands ),
+                       (int)( (long long)( band + 1 ) * pool->rows / pool->bands ) );
+        lk.lock();
+        if( ++pool->finished == pool->bands ) pool->done.notify_all();
+    }
+}
+
+CV_INLINE void icvRowPoolWorker( IcvRowPool* pool )
+{
+    std::unique_lock<std::mutex> lk( pool->lock );
+    for( ;; )
+    {
+        while( !pool->stop && pool->next >= pool->bands ) pool->wake.wait( lk );
+        if( pool->stop ) return;
+        icvRowPoolRun( pool, lk );
+    }
+}
+
+CV_INLINE IcvRowPool* icvCreateRowPool( int nthreads )
+{
+    IcvRowPool* pool = new IcvRowPool();
+    pool->body = NULL;
+    pool->rows = pool->bands = pool->next = pool->finished = 0;
+    pool->stop = false;
+    for( int i = 0; i < nthreads; i++ )
+        pool->threads.push_back( std::thread( icvRowPoolWorker, pool ) );
+    return pool;
+}
+
+CV_INLINE void icvReleaseRowPool( IcvRowPool** pool )
+{
+    if( *pool == NULL ) return;
+    {
+        std::lock_guard<std::mutex> lk( (*pool)->lock );
+        (*pool)->stop = true;
+    }
+    (*pool)->wake.notify_all();
+    for( size_t i = 0; i < (*pool)->threads.size(); i++ )
+        (*pool)->threads[i].join();
+    delete *pool;
+    *pool = NULL;
+}
+
+/**
+ * The pool shared by the process. One thread per core besides the caller.
+ */
+CV_INLINE IcvRowPool* icvGetRowPool()
+{
+    struct Holder {
+        IcvRowPool* pool;
+        Holder() : pool( icvCreateRowPool( (int)std::thread::hardware_concurrency() - 1 ) ) {}
+        ~Holder() { icvReleaseRowPool( &pool ); }
+    };
+    static Holder holder;
+    return holder.pool;
+}
+#endif
+
+/**
+ * Process the rows of an image in bands on all cores
+ *
+ * Uses TBB with HAVE_TBB, otherwise a pool of std::thread. Small images
+ * are processed on the calling thread, where the threads would cost more
+ * than they save. Without TBB, while another thread is using the pool,
+ * e.g., batch workers cropping at once, the rows are processed on the
+ * calling thread too, since the cores are busy anyway.
+ *
+ * @param rows   The number of rows
+ * @param pixels The number of pixels to be processed
+ * @param body   Processes the rows [y0, y1). Called concurrently for
+ *               disjoint bands.
+ * @return void
+ */
+CV_INLINE void icvParallelRows( int rows, double pixels, const std::function<void( int, int )>& body )
+{
+    if( pixels < ICV_PARALLEL_MIN_PIXELS || rows < 2 )
+    {
+        body( 0, rows );
+        return;
+    }
+#ifdef HAVE_TBB
+    tbb::parallel_for( tbb::blocked_range<int>( 0, rows ),
+                       [&body]( const tbb::blocked_range<int>& range ) { body( range.begin(), range.end() ); } );
+#else
+    IcvRowPool* pool = icvGetRowPool();
+    std::unique_lock<std::mutex> busy( pool->busy, std::try_to_lock );
+    if( !busy.owns_lock() || pool->threads.empty() )
+    {
+        body( 0, rows );
+        return;
+    }
+    std::unique_lock<std::mutex> lk( pool->lock );
+    pool->body = &body;
+    pool->rows = rows;
+    pool->bands = std::min( rows, (int)( pool->threads.size() + 1 ) * ICV_PARALLEL_BANDS_PER_THREAD );
+    pool->next = pool->finished = 0;
+    pool->wake.notify_all();
+    icvRowPoolRun( pool, lk );
+    while( pool->finished < pool->bands ) pool->done.wait( lk );
+    pool->body = NULL;
+    pool->bands = pool->next = 0;
+#endif
+}
+
+
+#endif
@@ -21,8 +21,8 @@
 * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
 * THE SOFTWARE.
 */
-#ifndef CV_CROPIMAGEROI_INCLUDED
-#define CV_CROPIMAGEROI_INCLUDED
+#ifndef CV_PUTIMAGEROI_INCLUDED
+#define CV_PUTIMAGEROI_INCLUDED
 
 #include "cv.h"
 #include "cvaux.h"
@@ -41,6 +41,28 @@ CVAPI(void) cvPutImageROI( const IplImage* src,
                            const IplImage* mask = NULL,
                            bool circumscribe = 0 );
 
+/**
+ * Copy the pixels of a row span whose mask is not 0
+ *
+ * @param CN  The number of channels, or 0 to use cn
+ * @param cn  The number of channels of T per pixel
+ */
+template<typename T, int CN>
+void icvPutRowMasked( const uchar* src, const uchar* mask, uchar* dst, int n, int cn )
+{
+    const T* s = (const T*)src;
+    T* d = (T*)dst;
+    int i, ch;
+    if( CN > 0 ) cn = CN;
+    for( i = 0; i < n; i++, s += cn, d += cn )
+    {
+        if( mask[i] == 0 ) continue;
+        for( ch = 0; ch < cn; ch++ ) d[ch] = s[ch];
+    }
+}
+
+typedef void (*IcvPutRowFunc)( const uchar* src, const uchar* mask, uchar* dst, int n, int cn );
+
 /**
  * Put a source image on the specified region on a target image 
  *
@@ -144,20 +166,27 @@ CVAPI(void) cvPutImageROI( const IplImage* src,
         CvPoint origin;
         IplImage* srctrans = cvCreateAffineImage( _src, affine, CV_AFFINE_FULL, &origin, CV_RGB(0,0,0) );
         IplImage* masktrans  = cvCreateAffineImage( _mask, affine, CV_AFFINE_FULL, NULL, cvScalar(0) );
-        for( int xp = 0; xp < srctrans->width; xp++ )
+        static const IcvPutRowFunc funcs[3][5] = ICV_KERNEL_TABLE( icvPutRowMasked );
+        int depth = icvDepthIndex( dst->depth ), cn = dst->nChannels;
+        int pixsize = ICV_DEPTH_BYTES( dst->depth ) * cn;
+        IcvPutRowFunc func = depth >= 0 ? funcs[depth][cn <= 4 ? cn : 0] : icvPutRowMasked<uchar, 0>;
+        if( depth < 0 ) cn = pixsize; // any pixel is copied as bytes
+        // the span of the transformed image inside of dst
+        int dx = rect.x + origin.x, dy = rect.y + origin.y;
+        int x0 = MAX( 0, -dx ), x1 = MIN( srctrans->width, dst->width - dx );
+        int y0 = MAX( 0, -dy ), y1 = MIN( srctrans->height, dst->height - dy );
+        if( x0 < x1 && y0 < y1 )
         {
-            int x = xp + rect.x + origin.x;
-            for( int yp = 0; yp < srctrans->height; yp++ )
+            icvParallelRows( y1 - y0, (double)( x1 - x0 ) * ( y1 - y0 ), [&]( int b0, int b1 )
             {
-                int y = yp + rect.y + origin.y;
-                if( x < 0 || x >= dst->width || y < 0 || y >= dst->height ) continue;
-                if( CV_IMAGE_ELEM( masktrans, uchar, yp, xp ) == 0 ) continue;
-                for( int ch = 0; ch < srctrans->nChannels; ch++ )
+                for( int yp = y0 + b0; yp < y0 + b1; yp++ )
                 {
-                    dst->imageData[dst->widthStep * y + x * dst->nChannels + ch]
-                        = srctrans->imageData[srctrans->widthStep * yp + xp * srctrans->nChannels + ch];
+                    func( (const uchar*)srctrans->imageData + srctrans->widthStep * yp + x0 * pixsize,
+                          (const uchar*)masktrans->imageData + masktrans->widthStep * yp + x0,
+                          (uchar*)dst->imageData + dst->widthStep * ( yp + dy ) + ( x0 + dx ) * pixsize,
+                          x1 - x0, cn );
                 }
-            }
+            } );
         }
         cvReleaseMat( &affine );
         cvReleaseImage( &srctrans );
@@ -0,0 +1,665 @@
+/** @file
+* The MIT License
+* 
+* Copyright (c) 2008, Naotoshi Seo <sonots(at)sonots.com>
+* 
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+* 
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+* 
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+#ifndef CV_WARPAFFINEROWS_INCLUDED
+#define CV_WARPAFFINEROWS_INCLUDED
+
+#include "cv.h"
+#include "cvaux.h"
+#include "cxcore.h"
+#include <math.h>
+#include <string.h>
+
+#include "cvparallelrows.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || ( defined(_M_IX86_FP) && _M_IX86_FP >= 2 )
+#define ICV_WARP_SSE2
+#include <emmintrin.h>
+#endif
+
+/** Source coordinates are rounded to 1 / ICV_INTER_TAB_SIZE pixel for interpolation */
+#define ICV_INTER_BITS 5
+#define ICV_INTER_TAB_SIZE ( 1 << ICV_INTER_BITS )
+/** 8 bits interpolation weights are fixed point of ICV_INTER_COEF_BITS fractional bits,
+    so that a weight times a pixel fits into 16 x 16 -> 32 bits products */
+#define ICV_INTER_COEF_BITS 14
+#define ICV_INTER_COEF_SCALE ( 1 << ICV_INTER_COEF_BITS )
+/** Pixels an interpolated sample reaches beyond its rounded source coordinate */
+#define ICV_INTER_REACH( interpolation ) \
+    ( (interpolation) == CV_INTER_CUBIC ? 2 : (interpolation) == CV_INTER_LINEAR ? 1 : 0 )
+
+CV_INLINE void icvWarpAffineRows( const IplImage* src, IplImage* dst, const double A[6],
+                                  int interpolation = CV_INTER_NN, const uchar* fill = NULL );
+
+/**
+ * floor( a / b ) for b != 0
+ */
+CV_INLINE int64 icvFloorDiv64( int64 a, int64 b )
+{
+    int64 q = a / b;
+    return ( a % b != 0 && ( a < 0 ) != ( b < 0 ) ) ? q - 1 : q;
+}
+
+/**
+ * Narrow [*x0, *x1) to the x where lo <= start + x * step < hi
+ */
+CV_INLINE void icvNarrowSpan( int64 start, int64 step, int64 lo, int64 hi, int* x0, int* x1 )
+{
+    int64 a, b;
+    if( step == 0 )
+    {
+        if( start < lo || start >= hi ) *x1 = *x0;
+        return;
+    }
+    if( step > 0 )
+    {
+        a = -icvFloorDiv64( start - lo, step );
+        b = -icvFloorDiv64( start - hi, step );
+    }
+    else
+    {
+        a = icvFloorDiv64( hi - start, step ) + 1;
+        b = icvFloorDiv64( lo - start, step ) + 1;
+    }
+    if( a > *x0 ) *x0 = (int)MIN( a, (int64)*x1 );
+    if( b < *x1 ) *x1 = (int)MAX( b, (int64)*x0 );
+}
+
+/**
+ * Bytes of a channel of an IplImage depth
+ */
+#define ICV_DEPTH_BYTES( depth ) ( ( (depth) & 255 ) >> 3 )
+
+/**
+ * Index of an IplImage depth in the kernel tables. -1 if not specialized.
+ */
+CV_INLINE int icvDepthIndex( int depth )
+{
+    return depth == IPL_DEPTH_8U ? 0 : depth == IPL_DEPTH_16U ? 1 : depth == IPL_DEPTH_32F ? 2 : -1;
+}
+
+/**
+ * A row of a kernel table of pixel type T, indexed by the number of
+ * channels. Channels other than 1, 3 and 4 are looped at runtime (CN = 0).
+ */
+#define ICV_KERNEL_ROW( func, T ) { func<T, 0>, func<T, 1>, func<T, 0>, func<T, 3>, func<T, 4> }
+
+/**
+ * The table of a kernel over the specialized depths, see icvDepthIndex
+ */
+#define ICV_KERNEL_TABLE( func ) \
+    { ICV_KERNEL_ROW( func, uchar ), ICV_KERNEL_ROW( func, ushort ), ICV_KERNEL_ROW( func, float ) }
+
+/**
+ * The table of an interpolating kernel, whose 8 bits row is func##8u<CN>
+ */
+#define ICV_INTER_KERNEL_TABLE( func ) \
+    { { func##8u<0>, func##8u<1>, func##8u<0>, func##8u<3>, func##8u<4> }, \
+      ICV_KERNEL_ROW( func, ushort ), ICV_KERNEL_ROW( func, float ) }
+
+/**
+ * Interpolation weights for each 1 / ICV_INTER_TAB_SIZE pixel offset
+ */
+typedef struct IcvInterTab {
+    /** 2D weights of 8 bits for the offset ( ty << ICV_INTER_BITS ) + tx, in
+        fixed point of ICV_INTER_COEF_BITS. The taps are [ky][kx], 2 x 2 for
+        linear and 4 x 4 for cubic, and sum to ICV_INTER_COEF_SCALE. */
+    short coef[ICV_INTER_TAB_SIZE * ICV_INTER_TAB_SIZE][16];
+    float coef32f[ICV_INTER_TAB_SIZE][4];  /**< 1D weights, for 16 bits and float */
+} IcvInterTab;
+
+/**
+ * Accumulation of interpolated samples of pixel type T
+ */
+template<typename T> struct IcvInterTraits
+{
+    typedef float WT;
+    static const float* coef( const IcvInterTab* tab, int i ) { return tab->coef32f[i]; }
+    static T cast( float v ) { return (T)v; }
+};
+
+template<> struct IcvInterTraits<ushort>
+{
+    typedef float WT;
+    static const float* coef( const IcvInterTab* tab, int i ) { return tab->coef32f[i]; }
+    static ushort cast( float v )
+    {
+        int i = cvRound( v );
+        return (ushort)MIN( MAX( i, 0 ), 65535 );
+    }
+};
+
+/**
+ * Copy a destination row span of nearest neighbor source pixels
+ *
+ * The source coordinates u, v and their steps are in 32.32 fixed point,
+ * offset by 0.5 so that the integer part is the rounded coordinate.
+ * All pixels of the span must be inside of the source.
+ *
+ * @param CN  The number of channels, or 0 to use cn
+ * @param cn  The number of channels of T per pixel
+ */
+template<typename T, int CN>
+void icvWarpRowNearest( const IplImage* img, uchar* dst, int n, int64 u, int64 v, int64 du, int64 dv,
+                        int cn, const IcvInterTab* )
+{
+    const uchar* base = (const uchar*)img->imageData;
+    int step = img->widthStep, i, ch;
+    T* d = (T*)dst;
+    if( CN > 0 ) cn = CN;
+#define ICV_WARP_SRC() ( (const T*)( base + (size_t)( v >> 32 ) * step ) + (size_t)( u >> 32 ) * cn )
+    if( n <= 0 ) return;
+    if( du == (int64)1 << 32 && dv == 0 )
+    {
+        memcpy( d, ICV_WARP_SRC(), (size_t)n * cn * sizeof(T) );
+        return;
+    }
+    for( i = 0; i < n; i++, d += cn, u += du, v += dv )
+    {
+        const T* s = ICV_WARP_SRC();
+        for( ch = 0; ch < cn; ch++ ) d[ch] = s[ch];
+    }
+#undef ICV_WARP_SRC
+}
+
+/**
+ * Precompute the weights for each 1 / ICV_INTER_TAB_SIZE pixel offset.
+ * The fixed point 2D weights of an offset sum to ICV_INTER_COEF_SCALE.
+ *
+ * @param interpolation CV_INTER_LINEAR (taps 0, 1) or CV_INTER_CUBIC (taps -1 .. 2)
+ * @param tab           The weights
+ * @return void
+ */
+CV_INLINE void icvInitInterTab( int interpolation, IcvInterTab* tab )
+{
+    const double a = -0.75; // same as cvResize and cvWarpAffine
+    int ksize = interpolation == CV_INTER_CUBIC ? 4 : 2;
+    int i, j, k;
+    for( i = 0; i < ICV_INTER_TAB_SIZE; i++ )
+    {
+        double t = (double)i / ICV_INTER_TAB_SIZE;
+        float* w = tab->coef32f[i];
+        if( interpolation == CV_INTER_CUBIC )
+        {
+            w[0] = (float)( ( ( a * ( t + 1 ) - 5 * a ) * ( t + 1 ) + 8 * a ) * ( t + 1 ) - 4 * a );
+            w[1] = (float)( ( ( a + 2 ) * t - ( a + 3 ) ) * t * t + 1 );
+            w[2] = (float)( ( ( a + 2 ) * ( 1 - t ) - ( a + 3 ) ) * ( 1 - t ) * ( 1 - t ) + 1 );
+            w[3] = 1 - w[0] - w[1] - w[2];
+        }
+        else
+        {
+            w[0] = (float)( 1 - t ); w[1] = (float)t; w[2] = w[3] = 0;
+        }
+    }
+    for( i = 0; i < ICV_INTER_TAB_SIZE; i++ )
+    {
+        for( j = 0; j < ICV_INTER_TAB_SIZE; j++ )
+        {
+            short* c = tab->coef[( i << ICV_INTER_BITS ) + j];
+            int sum = 0, kmax = 0;
+            memset( c, 0, sizeof(tab->coef[0]) );
+            for( k = 0; k < ksize * ksize; k++ )
+            {
+                c[k] = (short)cvRound( (double)tab->coef32f[i][k / ksize] * tab->coef32f[j][k % ksize]
+                                       * ICV_INTER_COEF_SCALE );
+                sum += c[k];
+                if( c[k] > c[kmax] ) kmax = k;
+            }
+            // so that flat regions stay flat
+            c[kmax] = (short)( c[kmax] + ICV_INTER_COEF_SCALE - sum );
+        }
+    }
+}
+
+/**
+ * The weights of an interpolation, computed once
+ *
+ * @param interpolation CV_INTER_LINEAR or CV_INTER_CUBIC
+ * @return The weights
+ */
+CV_INLINE const IcvInterTab* icvGetInterTab( int interpolation )
+{
+    static IcvInterTab linear, cubic;
+    static const bool ready = ( icvInitInterTab( CV_INTER_LINEAR, &linear ),
+                                icvInitInterTab( CV_INTER_CUBIC, &cubic ), true );
+    (void)ready;
+    return interpolation == CV_INTER_CUBIC ? &cubic : &linear;
+}
+
+/**
+ * Round and saturate an 8 bits sample accumulated with the 2D weights
+ */
+CV_INLINE uchar icvCastInter8u( int v )
+{
+    v = ( v + ( 1 << ( ICV_INTER_COEF_BITS - 1 ) ) ) >> ICV_INTER_COEF_BITS;
+    return (uchar)MIN( MAX( v, 0 ), 255 );
+}
+
+/**
+ * The 2D weights at the fixed point source coordinate u, v
+ */
+#define ICV_INTER_COEF( tab, u, v ) ( (tab)->coef[ \
+    ( ( (int)( (v) >> ( 32 - ICV_INTER_BITS ) ) & ( ICV_INTER_TAB_SIZE - 1 ) ) << ICV_INTER_BITS ) + \
+    ( (int)( (u) >> ( 32 - ICV_INTER_BITS ) ) & ( ICV_INTER_TAB_SIZE - 1 ) )] )
+
+/**
+ * Back from the rounding offset of icvWarpRowNearest to the rounding of the table
+ */
+#define ICV_INTER_OFFSET ( ( (int64)1 << ( 31 - ICV_INTER_BITS ) ) - ( (int64)1 << 31 ) )
+
+#ifdef ICV_WARP_SSE2
+/**
+ * 4 bytes at p into the low lane. p needs not be aligned.
+ */
+CV_INLINE __m128i icvLoad32( const uchar* p )
+{
+    int v;
+    memcpy( &v, p, sizeof(v) );
+    return _mm_cvtsi32_si128( v );
+}
+
+/**
+ * 2 pixels of CN = 3 or 4 channels at p as 16 bits, the channels of
+ * the pixels interleaved. CN = 3 reads one byte past the 2nd pixel.
+ */
+template<int CN> CV_INLINE __m128i icvLoadPair8u( const uchar* p, __m128i z )
+{
+    __m128i a = CN == 4 ? _mm_loadl_epi64( (const __m128i*)p ) :
+        _mm_unpacklo_epi32( icvLoad32( p ), icvLoad32( p + CN ) );
+    return _mm_unpacklo_epi8( _mm_unpacklo_epi8( a, _mm_srli_si128( a, 4 ) ), z );
+}
+
+/**
+ * Round, saturate and pack the 32 bits sums s into 8 bits
+ */
+CV_INLINE __m128i icvPackInter8u( __m128i s )
+{
+    s = _mm_srai_epi32( _mm_add_epi32( s, _mm_set1_epi32( 1 << ( ICV_INTER_COEF_BITS - 1 ) ) ),
+                        ICV_INTER_COEF_BITS );
+    s = _mm_packs_epi32( s, s );
+    return _mm_packus_epi16( s, s );
+}
+#endif
+
+/**
+ * Pixels [i0, i1) of a bilinear row span of 8 bits, replicating the border.
+ * u, v are of the pixel 0 with the offset of the table.
+ */
+template<int CN>
+void icvWarpSpanLinear8u( const IplImage* img, uchar* dst, int i0, int i1, int64 u, int64 v,
+                          int64 du, int64 dv, int cn, const IcvInterTab* tab )
+{
+    const uchar* base = (const uchar*)img->imageData;
+    int step = img->widthStep, i, ch;
+    int xmax = img->width - 1, ymax = img->height - 1;
+    uchar* d = dst + i0 * cn;
+    u += i0 * du; v += i0 * dv;
+    for( i = i0; i < i1; i++, d += cn, u += du, v += dv )
+    {
+        int x = (int)( u >> 32 ), y = (int)( v >> 32 );
+        const short* w = ICV_INTER_COEF( tab, u, v );
+        const uchar* r0 = base + (size_t)MAX( y, 0 ) * step;
+        const uchar* r1 = base + (size_t)MIN( y + 1, ymax ) * step;
+        int x0 = MAX( x, 0 ) * cn, x1 = MIN( x + 1, xmax ) * cn;
+        for( ch = 0; ch < cn; ch++ )
+            d[ch] = icvCastInter8u( r0[x0 + ch] * w[0] + r0[x1 + ch] * w[1] +
+                                    r1[x0 + ch] * w[2] + r1[x1 + ch] * w[3] );
+    }
+}
+
+/**
+ * Pixels [i0, i1) of a bicubic row span of 8 bits, as of icvWarpSpanLinear8u
+ */
+template<int CN>
+void icvWarpSpanCubic8u( const IplImage* img, uchar* dst, int i0, int i1, int64 u, int64 v,
+                         int64 du, int64 dv, int cn, const IcvInterTab* tab )
+{
+    const uchar* base = (const uchar*)img->imageData;
+    int step = img->widthStep, i, j, k, ch;
+    int xmax = img->width - 1, ymax = img->height - 1;
+    uchar* d = dst + i0 * cn;
+    u += i0 * du; v += i0 * dv;
+    for( i = i0; i < i1; i++, d += cn, u += du, v += dv )
+    {
+        int x = (int)( u >> 32 ), y = (int)( v >> 32 );
+        const short* w = ICV_INTER_COEF( tab, u, v );
+        const uchar* r[4];
+        int xs[4];
+        for( k = 0; k < 4; k++ )
+        {
+            r[k] = base + (size_t)MIN( MAX( y - 1 + k, 0 ), ymax ) * step;
+            xs[k] = MIN( MAX( x - 1 + k, 0 ), xmax ) * cn;
+        }
+        for( ch = 0; ch < cn; ch++ )
+        {
+            int s = 0;
+            for( k = 0; k < 4; k++ )
+                for( j = 0; j < 4; j++ ) s += r[k][xs[j] + ch] * w[k * 4 + j];
+            d[ch] = icvCastInter8u( s );
+        }
+    }
+}
+
+/**
+ * Copy a destination row span of bilinear interpolated 8 bits source pixels
+ *
+ * As icvWarpRowLinear. The pixels whose neighbors are all inside of the
+ * source are interpolated with SSE2 when available, bit exact with the
+ * others.
+ */
+template<int CN>
+void icvWarpRowLinear8u( const IplImage* img, uchar* dst, int n, int64 u, int64 v, int64 du, int64 dv,
+                         int cn, const IcvInterTab* tab )
+{
+    int i0 = n, i1 = n;
+    if( CN > 0 ) cn = CN;
+    u += ICV_INTER_OFFSET; v += ICV_INTER_OFFSET;
+#ifdef ICV_WARP_SSE2
+    if( CN > 0 )
+    {
+        const uchar* base = (const uchar*)img->imageData;
+        int step = img->widthStep, i;
+        // the loads of 3 channels overrun the last pixel of a row by a byte
+        int ylast = img->height - 1 - ( CN == 3 && step < img->width * 3 + 1 );
+        __m128i z = _mm_setzero_si128();
+        uchar* d;
+        int64 uu, vv;
+        i0 = 0;
+        icvNarrowSpan( u, du, 0, (int64)( img->width - 1 ) << 32, &i0, &i1 );
+        icvNarrowSpan( v, dv, 0, (int64)ylast << 32, &i0, &i1 );
+        d = dst + i0 * CN; uu = u + i0 * du; vv = v + i0 * dv;
+        if( CN == 1 )
+        {
+            for( i = i0; i <= i1 - 4; i += 4, d += 4 )
+            {
+                // the 2 x 2 neighbors of 4 pixels, a pixel per 32 bits
+                unsigned px[4];
+                __m128i w[4];
+                for( int k = 0; k < 4; k++, uu += du, vv += dv )
+                {
+                    const uchar* p = base + (size_t)( vv >> 32 ) * step + (size_t)( uu >> 32 );
+                    ushort r0, r1;
+                    memcpy( &r0, p, 2 ); memcpy( &r1, p + step, 2 );
+                    px[k] = r0 | ( (unsigned)r1 << 16 );
+                    w[k] = _mm_loadl_epi64( (const __m128i*)ICV_INTER_COEF( tab, uu, vv ) );
+                }
+                __m128i a = _mm_setr_epi32( (int)px[0], (int)px[1], (int)px[2], (int)px[3] );
+                __m128i s01 = _mm_madd_epi16( _mm_unpacklo_epi8( a, z ), _mm_unpacklo_epi64( w[0], w[1] ) );
+                __m128i s23 = _mm_madd_epi16( _mm_unpackhi_epi8( a, z ), _mm_unpacklo_epi64( w[2], w[3] ) );
+                // add the row sums of each pixel
+                __m128 f01 = _mm_castsi128_ps( s01 ), f23 = _mm_castsi128_ps( s23 );
+                __m128i e = _mm_castps_si128( _mm_shuffle_ps( f01, f23, _MM_SHUFFLE( 2, 0, 2, 0 ) ) );
+                __m128i o = _mm_castps_si128( _mm_shuffle_ps( f01, f23, _MM_SHUFFLE( 3, 1, 3, 1 ) ) );
+                int r = _mm_cvtsi128_si32( icvPackInter8u( _mm_add_epi32( e, o ) ) );
+                memcpy( d, &r, 4 );
+            }
+            icvWarpSpanLinear8u<CN>( img, dst, i, i1, u, v, du, dv, cn, tab );
+        }
+        else
+        {
+            for( i = i0; i < i1; i++, d += CN, uu += du, vv += dv )
+            {
+                const uchar* p = base + (size_t)( vv >> 32 ) * step + (size_t)( uu >> 32 ) * CN;
+                __m128i w = _mm_loadl_epi64( (const __m128i*)ICV_INTER_COEF( tab, uu, vv ) );
+                __m128i s = _mm_add_epi32(
+                    _mm_madd_epi16( icvLoadPair8u<CN>( p, z ), _mm_shuffle_epi32( w, 0 ) ),
+                    _mm_madd_epi16( icvLoadPair8u<CN>( p + step, z ), _mm_shuffle_epi32( w, 0x55 ) ) );
+                int r = _mm_cvtsi128_si32( icvPackInter8u( s ) );
+                memcpy( d, &r, CN );
+            }
+        }
+    }
+#endif
+    icvWarpSpanLinear8u<CN>( img, dst, 0, i0, u, v, du, dv, cn, tab );
+    icvWarpSpanLinear8u<CN>( img, dst, i1, n, u, v, du, dv, cn, tab );
+}
+
+/**
+ * Copy a destination row span of bicubic interpolated 8 bits source pixels
+ *
+ * As icvWarpRowCubic, with SSE2 as of icvWarpRowLinear8u.
+ */
+template<int CN>
+void icvWarpRowCubic8u( const IplImage* img, uchar* dst, int n, int64 u, int64 v, int64 du, int64 dv,
+                        int cn, const IcvInterTab* tab )
+{
+    int i0 = n, i1 = n;
+    if( CN > 0 ) cn = CN;
+    u += ICV_INTER_OFFSET; v += ICV_INTER_OFFSET;
+#ifdef ICV_WARP_SSE2
+    if( CN > 0 )
+    {
+        const uchar* base = (const uchar*)img->imageData;
+        int step = img->widthStep, i, k;
+        int ylast = img->height - 1 - ( CN == 3 && step < img->width * 3 + 1 );
+        __m128i z = _mm_setzero_si128();
+        uchar* d;
+        int64 uu, vv;
+        i0 = 0;
+        icvNarrowSpan( u, du, (int64)1 << 32, (int64)( img->width - 2 ) << 32, &i0, &i1 );
+        icvNarrowSpan( v, dv, (int64)1 << 32, (int64)( ylast - 1 ) << 32, &i0, &i1 );
+        d = dst + i0 * CN; uu = u + i0 * du; vv = v + i0 * dv;
+        for( i = i0; i < i1; i++, d += CN, uu += du, vv += dv )
+        {
+            const uchar* p = base + (size_t)( ( vv >> 32 ) - 1 ) * step + (size_t)( ( uu >> 32 ) - 1 ) * CN;
+            const short* w = ICV_INTER_COEF( tab, uu, vv );
+            __m128i s = _mm_setzero_si128();
+            if( CN == 1 )
+            {
+                // the 4 x 4 neighbors, 2 rows per half
+                __m128i a = _mm_unpacklo_epi64(
+                    _mm_unpacklo_epi32( icvLoad32( p ), icvLoad32( p + step ) ),
+                    _mm_unpacklo_epi32( icvLoad32( p + 2 * step ), icvLoad32( p + 3 * step ) ) );
+                s = _mm_add_epi32(
+                    _mm_madd_epi16( _mm_unpacklo_epi8( a, z ), _mm_loadu_si128( (const __m128i*)w ) ),
+                    _mm_madd_epi16( _mm_unpackhi_epi8( a, z ), _mm_loadu_si128( (const __m128i*)( w + 8 ) ) ) );
+                s = _mm_add_epi32( s, _mm_srli_si128( s, 8 ) );
+                s = _mm_add_epi32( s, _mm_srli_si128( s, 4 ) );
+                *d = icvCastInter8u( _mm_cvtsi128_si32( s ) );
+                continue;
+            }
+            for( k = 0; k < 4; k++, p += step )
+            {
+                __m128i a = CN == 4 ? _mm_loadu_si128( (const __m128i*)p ) :
+                    _mm_unpacklo_epi64( _mm_unpacklo_epi32( icvLoad32( p ), icvLoad32( p + 3 ) ),
+                                        _mm_unpacklo_epi32( icvLoad32( p + 6 ), icvLoad32( p + 9 ) ) );
+                __m128i lo = _mm_unpacklo_epi8( a, z ), hi = _mm_unpackhi_epi8( a, z );
+                __m128i wk = _mm_loadl_epi64( (const __m128i*)( w + k * 4 ) );
+                s = _mm_add_epi32( s, _mm_madd_epi16( _mm_unpacklo_epi16( lo, _mm_srli_si128( lo, 8 ) ),
+                                                      _mm_shuffle_epi32( wk, 0 ) ) );
+                s = _mm_add_epi32( s, _mm_madd_epi16( _mm_unpacklo_epi16( hi, _mm_srli_si128( hi, 8 ) ),
+                                                      _mm_shuffle_epi32( wk, 0x55 ) ) );
+            }
+            int r = _mm_cvtsi128_si32( icvPackInter8u( s ) );
+            memcpy( d, &r, CN );
+        }
+    }
+#endif
+    icvWarpSpanCubic8u<CN>( img, dst, 0, i0, u, v, du, dv, cn, tab );
+    icvWarpSpanCubic8u<CN>( img, dst, i1, n, u, v, du, dv, cn, tab );
+}
+
+/**
+ * Copy a destination row span of bilinear interpolated source pixels
+ *
+ * The coordinates are as of icvWarpRowNearest. Neighbors outside of the
+ * source are replicated from the border.
+ */
+template<typename T, int CN>
+void icvWarpRowLinear( const IplImage* img, uchar* dst, int n, int64 u, int64 v, int64 du, int64 dv,
+                       int cn, const IcvInterTab* tab )
+{
+    typedef typename IcvInterTraits<T>::WT WT;
+    const uchar* base = (const uchar*)img->imageData;
+    int step = img->widthStep, i, ch;
+    int xmax = img->width - 1, ymax = img->height - 1;
+    T* d = (T*)dst;
+    if( CN > 0 ) cn = CN;
+    u += ICV_INTER_OFFSET; v += ICV_INTER_OFFSET;
+    for( i = 0; i < n; i++, d += cn, u += du, v += dv )
+    {
+        int x = (int)( u >> 32 ), y = (int)( v >> 32 );
+        const WT* wx = IcvInterTraits<T>::coef( tab, (int)( u >> ( 32 - ICV_INTER_BITS ) ) & ( ICV_INTER_TAB_SIZE - 1 ) );
+        const WT* wy = IcvInterTraits<T>::coef( tab, (int)( v >> ( 32 - ICV_INTER_BITS ) ) & ( ICV_INTER_TAB_SIZE - 1 ) );
+        const T* r0 = (const T*)( base + (size_t)MAX( y, 0 ) * step );
+        const T* r1 = (const T*)( base + (size_t)MIN( y + 1, ymax ) * step );
+        int x0 = MAX( x, 0 ) * cn, x1 = MIN( x + 1, xmax ) * cn;
+        for( ch = 0; ch < cn; ch++ )
+        {
+            WT s0 = r0[x0 + ch] * wx[0] + r0[x1 + ch] * wx[1];
+            WT s1 = r1[x0 + ch] * wx[0] + r1[x1 + ch] * wx[1];
+            d[ch] = IcvInterTraits<T>::cast( s0 * wy[0] + s1 * wy[1] );
+        }
+    }
+}
+
+/**
+ * Copy a destination row span of bicubic interpolated source pixels
+ *
+ * The coordinates are as of icvWarpRowNearest. Neighbors outside of the
+ * source are replicated from the border.
+ */
+template<typename T, int CN>
+void icvWarpRowCubic( const IplImage* img, uchar* dst, int n, int64 u, int64 v, int64 du, int64 dv,
+                      int cn, const IcvInterTab* tab )
+{
+    typedef typename IcvInterTraits<T>::WT WT;
+    const uchar* base = (const uchar*)img->imageData;
+    int step = img->widthStep, i, k, ch;
+    int xmax = img->width - 1, ymax = img->height - 1;
+    T* d = (T*)dst;
+    if( CN > 0 ) cn = CN;
+    u += ICV_INTER_OFFSET; v += ICV_INTER_OFFSET;
+    for( i = 0; i < n; i++, d += cn, u += du, v += dv )
+    {
+        int x = (int)( u >> 32 ), y = (int)( v >> 32 );
+        const WT* wx = IcvInterTraits<T>::coef( tab, (int)( u >> ( 32 - ICV_INTER_BITS ) ) & ( ICV_INTER_TAB_SIZE - 1 ) );
+        const WT* wy = IcvInterTraits<T>::coef( tab, (int)( v >> ( 32 - ICV_INTER_BITS ) ) & ( ICV_INTER_TAB_SIZE - 1 ) );
+        const T* r[4];
+        int xs[4];
+        for( k = 0; k < 4; k++ )
+        {
+            r[k] = (const T*)( base + (size_t)MIN( MAX( y - 1 + k, 0 ), ymax ) * step );
+            xs[k] = MIN( MAX( x - 1 + k, 0 ), xmax ) * cn;
+        }
+        for( ch = 0; ch < cn; ch++ )
+        {
+            WT s[4];
+            for( k = 0; k < 4; k++ )
+            {
+                const T* p = r[k] + ch;
+                s[k] = p[xs[0]] * wx[0] + p[xs[1]] * wx[1] + p[xs[2]] * wx[2] + p[xs[3]] * wx[3];
+            }
+            d[ch] = IcvInterTraits<T>::cast( s[0] * wy[0] + s[1] * wy[1] + s[2] * wy[2] + s[3] * wy[3] );
+        }
+    }
+}
+
+typedef void (*IcvWarpRowFunc)( const IplImage* img, uchar* dst, int n, int64 u, int64 v, int64 du, int64 dv,
+                                int cn, const IcvInterTab* tab );
+
+/**
+ * Fill a destination row span with a pixel value
+ */
+CV_INLINE void icvFillRow( uchar* d, int n, const uchar* fill, int pixsize, bool zero )
+{
+    int i;
+    if( n <= 0 || fill == NULL ) return;
+    if( zero ) { memset( d, 0, (size_t)n * pixsize ); return; }
+    for( i = 0; i < n; i++, d += pixsize ) memcpy( d, fill, pixsize );
+}
+
+/**
+ * Warp an image by an affine transform row by row
+ *
+ * The destination pixel (x, y) samples the source at
+ * ( A[0] x + A[1] y + A[2], A[3] x + A[4] y + A[5] ). Pixels whose rounded
+ * source coordinate lies outside of the source are filled; the others are
+ * sampled with the interpolation, replicating the border for the neighbors.
+ * Rows are walked in memory order and the source coordinates advance
+ * incrementally in fixed point. The span of each row inside of the source
+ * is solved exactly from the fixed point coordinates, so pixels are not
+ * tested one by one.
+ *
+ * The row kernels are specialized for 8U, 16U and 32F with 1, 3 or 4
+ * channels, and 8U bilinear and bicubic with SSE2. Other depths are
+ * sampled by nearest neighbor only. Large destinations are split into
+ * row bands over all cores.
+ *
+ * @param src           The source image
+ * @param dst           The destination image of the same depth and channels
+ * @param A             The 2 x 3 affine from destination to source coordinates
+ * @param [interpolation = CV_INTER_NN]
+ *                      CV_INTER_NN, CV_INTER_LINEAR or CV_INTER_CUBIC
+ * @param [fill = NULL] The pixel outside of the source, as stored in src.
+ *                      NULL leaves the destination as it is there.
+ * @return void
+ */
+CV_INLINE void icvWarpAffineRows( const IplImage* src, IplImage* dst, const double A[6],
+                                  int interpolation, const uchar* fill )
+{
+    static const IcvWarpRowFunc nearest[3][5] = ICV_KERNEL_TABLE( icvWarpRowNearest );
+    static const IcvWarpRowFunc linear[3][5] = ICV_INTER_KERNEL_TABLE( icvWarpRowLinear );
+    static const IcvWarpRowFunc cubic[3][5] = ICV_INTER_KERNEL_TABLE( icvWarpRowCubic );
+    const double one = 4294967296.0; // 1 << 32
+    int64 du = (int64)floor( A[0] * one + 0.5 ), dv = (int64)floor( A[3] * one + 0.5 );
+    int64 umax = (int64)src->width << 32, vmax = (int64)src->height << 32;
+    int depth = icvDepthIndex( src->depth ), cn = src->nChannels;
+    int pixsize = ICV_DEPTH_BYTES( src->depth ) * cn, k;
+    IcvWarpRowFunc func;
+    const IcvInterTab* tab = NULL;
+    bool zero = true;
+    for( k = 0; fill != NULL && k < pixsize; k++ ) zero = zero && fill[k] == 0;
+    if( depth < 0 )
+    {
+        // any pixel is copied as bytes
+        func = icvWarpRowNearest<uchar, 0>;
+        cn = pixsize;
+    }
+    else
+    {
+        func = ( interpolation == CV_INTER_LINEAR ? linear :
+                 interpolation == CV_INTER_CUBIC ? cubic : nearest )[depth][cn <= 4 ? cn : 0];
+        if( interpolation != CV_INTER_NN ) tab = icvGetInterTab( interpolation );
+    }
+    // interpolated pixels cost about as much as that many more copied ones
+    double cost = interpolation == CV_INTER_CUBIC ? 16 : interpolation == CV_INTER_LINEAR ? 4 : 1;
+    icvParallelRows( dst->height, cost * dst->width * dst->height, [&]( int y0, int y1 )
+    {
+        for( int y = y0; y < y1; y++ )
+        {
+            int64 u = (int64)floor( ( A[1] * y + A[2] + 0.5 ) * one );
+            int64 v = (int64)floor( ( A[4] * y + A[5] + 0.5 ) * one );
+            int x0 = 0, x1 = dst->width;
+            uchar* d = (uchar*)dst->imageData + (size_t)dst->widthStep * y;
+            icvNarrowSpan( u, du, 0, umax, &x0, &x1 );
+            icvNarrowSpan( v, dv, 0, vmax, &x0, &x1 );
+            icvFillRow( d, x0, fill, pixsize, zero );
+            if( x1 > x0 ) func( src, d + x0 * pixsize, x1 - x0, u + x0 * du, v + x0 * dv, du, dv, cn, tab );
+            icvFillRow( d + x1 * pixsize, dst->width - x1, fill, pixsize, zero );
+        }
+    } );
+}
+
+
+#endif